@@ -0,0 +1,45 @@
+import json
+import sys
+
+# Compares two render_benchmark JSON files, e.g. from a baseline commit and a
+# change, printing the median time of every stage per configuration and the
+# relative change.
+#
+#   python benchmarks/compare_benchmarks.py baseline.json change.json [stage...]
+
+DEFAULT_STAGES = ["ingest", "sort", "render", "readback", "frame"]
+
+
+def configKey(result):
+    return (result["n_particles"], result["width"], result["height"], result["translucent_fraction"], result["camera_distance"])
+
+
+def main():
+    if len(sys.argv) < 3:
+        print("usage: python compare_benchmarks.py <baseline.json> <change.json> [stage...]")
+        return 1
+    with open(sys.argv[1]) as file:
+        baseline = json.load(file)
+    with open(sys.argv[2]) as file:
+        change = json.load(file)
+    stages = sys.argv[3:] or DEFAULT_STAGES
+
+    baseline_results = {configKey(result): result for result in baseline["results"]}
+    print(f"{'particles':>10} {'resolution':>11} {'transl':>6} {'dist':>5} " + " ".join(f"{stage:>22}" for stage in stages))
+    for result in change["results"]:
+        key = configKey(result)
+        if key not in baseline_results:
+            continue
+        columns = []
+        for stage in stages:
+            before = baseline_results[key]["stages"][stage]["median_ms"]
+            after = result["stages"][stage]["median_ms"]
+            relative = f"{(after - before) / before * 100.0:+.1f}%" if before > 0.0 else "n/a"
+            columns.append(f"{before:8.3f}>{after:8.3f} {relative:>5}")
+        n_particles, width, height, translucent, distance = key
+        print(f"{n_particles:>10} {f'{width}x{height}':>11} {translucent:>6} {distance:>5} " + " ".join(f"{column:>22}" for column in columns))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
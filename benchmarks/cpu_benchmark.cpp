@@ -0,0 +1,467 @@
+// Microbenchmarks of the renderer's CPU kernels. Only the kernel headers are
+// compiled in, so it runs without a display, GL driver or Python. Particle
+// data comes from fixed seeds in three distributions: a uniform cube, a dam
+// break block on a lattice in index order and Gaussian clusters.
+//
+//   cpu_benchmark [--n 1000000] [--repetitions 10] [--json results.json]
+//
+// Each kernel reports the fastest repetition as nanoseconds and TSC cycles per
+// element and as bytes per second over the bytes it reads and writes.
+
+#include "defintions.h"
+#include "glmath.h"
+#include "arena.h"
+#include "utility.h"
+#include "threading.h"
+#include "sort.h"
+#include "ingest.h"
+#include "ply.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCHMARK_HAS_TSC 1
+#else
+#define BENCHMARK_HAS_TSC 0
+#endif
+
+
+struct KernelResult
+{
+    std::string kernel;
+    std::string distribution;
+    i64 elements;
+    i64 bytes;
+    f64 ns_per_element;
+    f64 cycles_per_element; // 0 without a timestamp counter
+    f64 bytes_per_second;
+};
+
+enum class Distribution : u32
+{
+    UNIFORM_CUBE,
+    DAM_BREAK,
+    CLUSTERED
+};
+constexpr const char *DISTRIBUTION_NAMES[] = {"uniform_cube", "dam_break", "clustered"};
+
+// Keeps a result alive so the compiler can't drop the kernel computing it.
+inline void keepAlive(const void *value)
+{
+    asm volatile("" : : "g"(value) : "memory");
+}
+
+inline u64 readCycleCounter()
+{
+#if BENCHMARK_HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Runs kernel once to warm up and then repetitions times, keeping the fastest.
+template <typename F>
+KernelResult measureKernel(const char *kernel_name, const char *distribution, i64 elements, i64 bytes, i32 repetitions, F &&kernel)
+{
+    kernel();
+    f64 best_ns = 0.0;
+    u64 best_cycles = 0;
+    for(i32 repetition = 0; repetition < repetitions; ++repetition)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const u64 start_cycles = readCycleCounter();
+        kernel();
+        const u64 cycles = readCycleCounter() - start_cycles;
+        const std::chrono::duration<f64, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        if(repetition == 0 || elapsed.count() < best_ns)
+        {
+            best_ns = elapsed.count();
+            best_cycles = cycles;
+        }
+    }
+    const KernelResult result = {kernel_name, distribution, elements, bytes,
+                                 best_ns / static_cast<f64>(elements),
+                                 static_cast<f64>(best_cycles) / static_cast<f64>(elements),
+                                 static_cast<f64>(bytes) / (best_ns * 1.0e-9)};
+    printf("%-28s %-13s %10lld %10.3f ns %10.3f cyc %10.3f GB/s\n", kernel_name, distribution, elements,
+           result.ns_per_element, result.cycles_per_element, result.bytes_per_second / 1.0e9);
+    return result;
+}
+
+// Tightly packed xyz positions in the unit cube.
+std::vector<f32> generatePositions(Distribution distribution, i64 n_particles)
+{
+    std::mt19937 generator(42 + static_cast<u32>(distribution));
+    std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+    std::vector<f32> positions(n_particles * 3);
+    if(distribution == Distribution::UNIFORM_CUBE)
+    {
+        for(f32 &coordinate : positions)
+            coordinate = unit(generator);
+    }
+    else if(distribution == Distribution::DAM_BREAK)
+    {
+        // A column of fluid against one wall, laid out x fastest as a simulation emits it.
+        const i64 side = static_cast<i64>(std::ceil(std::cbrt(static_cast<f64>(n_particles) / 2.0)));
+        const f32 spacing = 0.5f / static_cast<f32>(side);
+        std::uniform_real_distribution<f32> jitter(-0.05f * spacing, 0.05f * spacing);
+        for(i64 i = 0; i < n_particles; ++i)
+        {
+            const i64 x = i % side;
+            const i64 y = (i / side) % (2 * side);
+            const i64 z = i / (2 * side * side);
+            positions[i * 3] = (static_cast<f32>(x) + 0.5f) * spacing + jitter(generator);
+            positions[i * 3 + 1] = (static_cast<f32>(y) + 0.5f) * spacing + jitter(generator);
+            positions[i * 3 + 2] = (static_cast<f32>(z) + 0.5f) * spacing + jitter(generator);
+        }
+    }
+    else
+    {
+        constexpr i32 n_clusters = 16;
+        std::array<glmath::Vec3, n_clusters> centres;
+        for(glmath::Vec3 &centre : centres)
+            centre = {0.1f + 0.8f * unit(generator), 0.1f + 0.8f * unit(generator), 0.1f + 0.8f * unit(generator)};
+        std::normal_distribution<f32> spread(0.0f, 0.03f);
+        std::uniform_int_distribution<i32> cluster(0, n_clusters - 1);
+        for(i64 i = 0; i < n_particles; ++i)
+        {
+            const glmath::Vec3 &centre = centres[cluster(generator)];
+            for(i32 axis = 0; axis < 3; ++axis)
+                positions[i * 3 + axis] = std::clamp(centre.data[axis] + spread(generator), 0.0f, 1.0f);
+        }
+    }
+    return positions;
+}
+
+void benchmarkDepthSort(std::vector<KernelResult> &results, const char *distribution, const std::vector<f32> &positions, i32 repetitions)
+{
+    const i64 n_particles = static_cast<i64>(positions.size() / 3);
+    const glmath::Vec3 camera_pos = {0.5f, 0.5f, -2.0f};
+    std::vector<u32> keys(n_particles);
+    std::vector<u32> indices(n_particles);
+    RadixSortScratch scratch;
+    auto distanceSquared = [&](u32 i)
+    {
+        const f32 dx = camera_pos.x - positions[i * 3];
+        const f32 dy = camera_pos.y - positions[i * 3 + 1];
+        const f32 dz = camera_pos.z - positions[i * 3 + 2];
+        return dx * dx + dy * dy + dz * dz;
+    };
+
+    // Positions read, keys written, then four passes over (key, index) in and out.
+    const i64 radix_bytes = n_particles * (3 * sizeof(f32) + sizeof(u32) + RADIX_PASSES * 4 * sizeof(u32));
+    results.push_back(measureKernel("depth_sort_radix", distribution, n_particles, radix_bytes, repetitions, [&]
+    {
+        for(i64 i = 0; i < n_particles; ++i)
+        {
+            indices[i] = static_cast<u32>(i);
+            keys[i] = farToNearKey(distanceSquared(static_cast<u32>(i)));
+        }
+        radixSortKeyIndex(keys.data(), indices.data(), n_particles, scratch);
+        keepAlive(indices.data());
+    }));
+    // TEMPORAL's repair of last frame's order, for particles that moved a
+    // fraction of their spacing since: little enough to repair, and enough
+    // that it gives up and radix sorts as the renderer does. Keys, the
+    // previous order, the gathered pairs and the written indices, then the
+    // repair's pass over the pairs in and out.
+    std::vector<u32> previous_order(n_particles);
+    std::vector<u64> pairs(n_particles);
+    const i64 temporal_bytes = n_particles * (3 * sizeof(f32) + 3 * sizeof(u32) + 3 * sizeof(u64) + sizeof(u32));
+    for(const auto &[kernel_name, step_fraction] : {std::pair<const char*, f32>{"depth_sort_temporal", 1.0e-4f}, {"depth_sort_temporal_fallback", 1.0e-2f}})
+    {
+        std::mt19937 generator(5);
+        std::normal_distribution<f32> step(0.0f, step_fraction / std::cbrt(static_cast<f32>(n_particles)));
+        for(i64 i = 0; i < n_particles; ++i)
+        {
+            f32 distance_squared = 0.0f;
+            for(i32 axis = 0; axis < 3; ++axis)
+            {
+                const f32 delta = camera_pos.data[axis] - (positions[i * 3 + axis] + step(generator));
+                distance_squared += delta * delta;
+            }
+            previous_order[i] = static_cast<u32>(i);
+            keys[i] = farToNearKey(distance_squared);
+        }
+        radixSortKeyIndex(keys.data(), previous_order.data(), n_particles, scratch);
+        results.push_back(measureKernel(kernel_name, distribution, n_particles, temporal_bytes, repetitions, [&]
+        {
+            for(i64 i = 0; i < n_particles; ++i)
+                keys[i] = farToNearKey(distanceSquared(static_cast<u32>(i)));
+            for(i64 i = 0; i < n_particles; ++i)
+                pairs[i] = keyIndexPair(keys[previous_order[i]], previous_order[i]);
+            if(sortNearlySortedPairs(pairs.data(), n_particles) >= 0)
+            {
+                for(i64 i = 0; i < n_particles; ++i)
+                    indices[i] = pairIndex(pairs[i]);
+            }
+            else
+            {
+                for(i64 i = 0; i < n_particles; ++i)
+                {
+                    indices[i] = static_cast<u32>(i);
+                    keys[i] = farToNearKey(distanceSquared(static_cast<u32>(i)));
+                }
+                radixSortKeyIndex(keys.data(), indices.data(), n_particles, scratch);
+            }
+            keepAlive(indices.data());
+        }));
+    }
+    results.push_back(measureKernel("depth_sort_std", distribution, n_particles, n_particles * (3 * sizeof(f32) + sizeof(u32)), repetitions, [&]
+    {
+        std::iota(indices.begin(), indices.end(), 0u);
+        std::sort(indices.begin(), indices.end(), [&](u32 a, u32 b) { return distanceSquared(a) > distanceSquared(b); });
+        keepAlive(indices.data());
+    }));
+}
+
+void benchmarkIngest(std::vector<KernelResult> &results, const char *distribution, const std::vector<f32> &positions, i32 repetitions)
+{
+    const i64 n_particles = static_cast<i64>(positions.size() / 3);
+    // Destination laid out like ParticleData: a position and a colour vec4.
+    constexpr i64 particle_stride = 8;
+    std::vector<f32> particles(n_particles * particle_stride);
+    std::vector<f64> positions_f64(positions.begin(), positions.end());
+    std::vector<f32> columns(n_particles * 3); // (3, n) transposed, as a Fortran ordered array arrives
+    for(i64 i = 0; i < n_particles; ++i)
+        for(i64 axis = 0; axis < 3; ++axis)
+            columns[axis * n_particles + i] = positions[i * 3 + axis];
+    std::vector<f32> compact(n_particles * 3);
+
+    const i64 vec4_bytes = n_particles * 4 * sizeof(f32);
+    const IngestSource packed_f32 = {positions.data(), n_particles, 3, 1, 3, IngestType::F32};
+    results.push_back(measureKernel("ingest_vec3_f32", distribution, n_particles, n_particles * 3 * sizeof(f32) + vec4_bytes, repetitions, [&]
+    {
+        ingestRows4(particles.data(), particle_stride, packed_f32, 0, n_particles);
+        keepAlive(particles.data());
+    }));
+    const IngestSource packed_f64 = {positions_f64.data(), n_particles, 3, 1, 3, IngestType::F64};
+    results.push_back(measureKernel("ingest_vec3_f64", distribution, n_particles, n_particles * 3 * sizeof(f64) + vec4_bytes, repetitions, [&]
+    {
+        ingestRows4(particles.data(), particle_stride, packed_f64, 0, n_particles);
+        keepAlive(particles.data());
+    }));
+    const IngestSource strided_f32 = {columns.data(), n_particles, 1, n_particles, 3, IngestType::F32};
+    results.push_back(measureKernel("ingest_vec3_f32_strided", distribution, n_particles, n_particles * 3 * sizeof(f32) + vec4_bytes, repetitions, [&]
+    {
+        ingestRows4(particles.data(), particle_stride, strided_f32, 0, n_particles);
+        keepAlive(particles.data());
+    }));
+    results.push_back(measureKernel("ingest_compact_f64", distribution, n_particles, n_particles * 3 * (sizeof(f64) + sizeof(f32)), repetitions, [&]
+    {
+        ingestRows3(compact.data(), packed_f64, 0, n_particles);
+        keepAlive(compact.data());
+    }));
+}
+
+void benchmarkColourPacking(std::vector<KernelResult> &results, i64 n_particles, i32 repetitions)
+{
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+    std::vector<f32> colours(n_particles * 4);
+    for(f32 &channel : colours)
+        channel = unit(generator);
+    std::vector<u32> packed(n_particles);
+    const IngestSource source = {colours.data(), n_particles, 4, 1, 4, IngestType::F32};
+    results.push_back(measureKernel("pack_rgba8", "uniform", n_particles, n_particles * (4 * sizeof(f32) + sizeof(u32)), repetitions, [&]
+    {
+        packRowsRGBA8(packed.data(), source, 0, n_particles);
+        keepAlive(packed.data());
+    }));
+}
+
+void benchmarkRowFlip(std::vector<KernelResult> &results, i32 repetitions)
+{
+    for(const auto &[width, height] : {std::pair<i32, i32>{640, 480}, {1920, 1080}, {3840, 2160}})
+    {
+        const i64 row_bytes = static_cast<i64>(width) * 3;
+        std::vector<u8> pixels(row_bytes * height, 0x7F);
+        std::vector<u8> row_scratch;
+        char name[64];
+        snprintf(name, sizeof(name), "flip_rows_%dx%d", width, height);
+        const i64 n_pixels = static_cast<i64>(width) * height;
+        results.push_back(measureKernel(name, "-", n_pixels, 2 * n_pixels * 3, repetitions, [&]
+        {
+            flipRowsInPlace(pixels.data(), row_bytes, height, row_scratch);
+            keepAlive(pixels.data());
+        }));
+    }
+}
+
+void benchmarkMatrices(std::vector<KernelResult> &results, i32 repetitions)
+{
+    constexpr i64 n_matrices = 1 << 16;
+    std::mt19937 generator(11);
+    std::uniform_real_distribution<f32> unit(-1.0f, 1.0f);
+    std::vector<glmath::Mat4x4> a(n_matrices), b(n_matrices), out(n_matrices);
+    std::vector<glmath::Vec3> eyes(n_matrices);
+    for(i64 i = 0; i < n_matrices; ++i)
+    {
+        for(i32 column = 0; column < 4; ++column)
+        {
+            for(i32 row = 0; row < 4; ++row)
+            {
+                a[i].data[column][row] = unit(generator);
+                b[i].data[column][row] = unit(generator);
+            }
+        }
+        eyes[i] = {unit(generator) * 4.0f, unit(generator) * 4.0f, unit(generator) * 4.0f - 5.0f};
+    }
+
+    const i64 matrix_bytes = sizeof(glmath::Mat4x4);
+    results.push_back(measureKernel("mat4x4_multiply", "-", n_matrices, n_matrices * 3 * matrix_bytes, repetitions, [&]
+    {
+        for(i64 i = 0; i < n_matrices; ++i)
+            out[i] = a[i] * b[i];
+        keepAlive(out.data());
+    }));
+    results.push_back(measureKernel("look_at", "-", n_matrices, n_matrices * (sizeof(glmath::Vec3) + matrix_bytes), repetitions, [&]
+    {
+        for(i64 i = 0; i < n_matrices; ++i)
+            out[i] = glmath::lookAt(eyes[i], {0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f});
+        keepAlive(out.data());
+    }));
+    results.push_back(measureKernel("perspective_projection", "-", n_matrices, n_matrices * matrix_bytes, repetitions, [&]
+    {
+        for(i64 i = 0; i < n_matrices; ++i)
+            out[i] = glmath::perspectiveProjection(0.5f + 0.5f * eyes[i].x * eyes[i].x, 1.5f, 0.1f, 1000.0f);
+        keepAlive(out.data());
+    }));
+}
+
+// A binary PLY of position and normal vertices and triangle faces, the layout
+// loadPlyModelPos reads.
+std::string generatePly(i64 n_vertices, i64 n_triangles)
+{
+    std::string blob = "ply\nformat binary_little_endian 1.0\nelement vertex " + std::to_string(n_vertices) +
+        "\nproperty float x\nproperty float y\nproperty float z\nproperty float nx\nproperty float ny\nproperty float nz\n"
+        "element face " + std::to_string(n_triangles) + "\nproperty list uchar int vertex_indices\nend_header\n";
+    std::mt19937 generator(13);
+    std::uniform_real_distribution<f32> unit(-1.0f, 1.0f);
+    for(i64 i = 0; i < n_vertices * 6; ++i)
+    {
+        const f32 value = unit(generator);
+        blob.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    for(i64 i = 0; i < n_triangles; ++i)
+    {
+        blob.push_back(3);
+        for(i64 corner = 0; corner < 3; ++corner)
+        {
+            const u32 index = static_cast<u32>((i + corner) % n_vertices);
+            blob.append(reinterpret_cast<const char*>(&index), sizeof(index));
+        }
+    }
+    return blob;
+}
+
+void benchmarkPly(std::vector<KernelResult> &results, i32 repetitions)
+{
+    constexpr i64 n_vertices = 1 << 18;
+    constexpr i64 n_triangles = 2 * n_vertices;
+    const std::string blob = generatePly(n_vertices, n_triangles);
+    const ptrdiff_t vertex_bytes = n_vertices * sizeof(VertexPosNormal) + 64;
+    const ptrdiff_t index_bytes = n_triangles * 3 * sizeof(i32) + 64;
+    Arena arena(vertex_bytes + index_bytes + 256);
+    SubArena vertices(arena, vertex_bytes);
+    SubArena indices(arena, index_bytes);
+
+    results.push_back(measureKernel("load_ply_model_pos", "-", n_vertices + n_triangles, static_cast<i64>(blob.size()) + vertex_bytes + index_bytes, repetitions, [&]
+    {
+        ModelMetaData meta_data = {};
+        meta_data.blob = blob;
+        getPlyMetaData(meta_data);
+        vertices.offset = 0;
+        indices.offset = 0;
+        loadPlyModelPos(vertices, indices, meta_data);
+        keepAlive(vertices.start);
+    }));
+    arena.freeArena();
+}
+
+void benchmarkArena(std::vector<KernelResult> &results, i32 repetitions)
+{
+    constexpr i64 n_pushes = 1 << 20;
+    // Mixed sizes and alignments, so the padding arithmetic does real work.
+    constexpr ptrdiff_t bytes_per_round = sizeof(glmath::Vec3) + sizeof(u8) + sizeof(u64) + 4 * sizeof(f32) + 16;
+    Arena arena(n_pushes / 4 * bytes_per_round);
+    results.push_back(measureKernel("arena_push", "-", n_pushes, n_pushes / 4 * bytes_per_round, repetitions, [&]
+    {
+        arena.offset = 0;
+        for(i64 i = 0; i < n_pushes / 4; ++i)
+        {
+            keepAlive(arena.arenaPush<glmath::Vec3>(1));
+            keepAlive(arena.arenaPush<u8>(1));
+            keepAlive(arena.arenaPush<u64>(1));
+            keepAlive(arena.arenaPush<f32>(4));
+        }
+    }));
+    arena.freeArena();
+}
+
+bool writeJson(const char *path, const std::vector<KernelResult> &results)
+{
+    FILE *file = fopen(path, "w");
+    if(file == nullptr)
+        return false;
+    fprintf(file, "{\n  \"has_tsc\": %s,\n  \"results\": [\n", BENCHMARK_HAS_TSC ? "true" : "false");
+    for(u64 i = 0; i < results.size(); ++i)
+    {
+        const KernelResult &result = results[i];
+        fprintf(file, "    {\"kernel\": \"%s\", \"distribution\": \"%s\", \"elements\": %lld, \"bytes\": %lld, \"ns_per_element\": %.5f, \"cycles_per_element\": %.5f, \"bytes_per_second\": %.1f}%s\n",
+                result.kernel.c_str(), result.distribution.c_str(), result.elements, result.bytes, result.ns_per_element,
+                result.cycles_per_element, result.bytes_per_second, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    i64 n_particles = 1000000;
+    i32 repetitions = 10;
+    const char *json_path = nullptr;
+    for(i32 i = 1; i + 1 < argc; i += 2)
+    {
+        const std::string flag = argv[i];
+        if(flag == "--n")
+            n_particles = static_cast<i64>(std::stod(argv[i + 1]));
+        else if(flag == "--repetitions")
+            repetitions = std::stoi(argv[i + 1]);
+        else if(flag == "--json")
+            json_path = argv[i + 1];
+    }
+    if(argc % 2 == 0 || n_particles < 1 || repetitions < 1)
+    {
+        printf("usage: cpu_benchmark [--n 1000000] [--repetitions 10] [--json results.json]\n");
+        return 1;
+    }
+
+    std::vector<KernelResult> results;
+    for(Distribution distribution : {Distribution::UNIFORM_CUBE, Distribution::DAM_BREAK, Distribution::CLUSTERED})
+    {
+        const char *name = DISTRIBUTION_NAMES[static_cast<u32>(distribution)];
+        const std::vector<f32> positions = generatePositions(distribution, n_particles);
+        benchmarkDepthSort(results, name, positions, repetitions);
+        benchmarkIngest(results, name, positions, repetitions);
+    }
+    benchmarkColourPacking(results, n_particles, repetitions);
+    benchmarkRowFlip(results, repetitions);
+    benchmarkMatrices(results, repetitions);
+    benchmarkPly(results, repetitions);
+    benchmarkArena(results, repetitions);
+
+    if(json_path != nullptr && !writeJson(json_path, results))
+    {
+        printf("Couldn't write %s.\n", json_path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,368 @@
+// Headless end-to-end benchmark of the EGL renderer. Sweeps particle counts,
+// resolutions, translucent fractions and camera distances, times every stage
+// of a frame over many iterations and writes the results as JSON, so runs on
+// different commits can be compared with benchmarks/compare_benchmarks.py.
+// Needs no GPU; Mesa's llvmpipe is enough.
+//
+//   render_benchmark --counts 1000,100000 --resolutions 640x480 --iterations 20 --output results.json
+//
+// Lists are comma separated. Defaults sweep counts 1e3 to 1e7, 640x480 and
+// 1920x1080, translucent fractions 0, 0.5 and 1 and camera distances 1, 2 and 4.
+
+#define RENDERER_NO_MAIN
+#include "glrendererEGL.cpp"
+
+#include <random>
+#include <ctime>
+
+
+struct BenchmarkOptions
+{
+    std::vector<i64> counts = {1000, 10000, 100000, 1000000, 10000000};
+    std::vector<std::array<i32, 2>> resolutions = {{640, 480}, {1920, 1080}};
+    std::vector<f32> translucent_fractions = {0.0f, 0.5f, 1.0f};
+    std::vector<f32> camera_distances = {1.0f, 2.0f, 4.0f};
+    i32 iterations = 10;
+    i32 warmup = 2;
+    bool encode_png = true;
+    bool encode_qoi = true;
+    SortMode sort_mode = SortMode::RADIX;
+    BlendMode blend_mode = BlendMode::SORTED;
+    QuadPath quad_path = QuadPath::INSTANCED_STRIP;
+    SphereMode sphere_mode = SphereMode::FLAT_BILLBOARD;
+    bool count_fragments = false;
+    std::string output = "render_benchmark.json";
+};
+
+enum class Stage : u32
+{
+    INGEST,
+    CULL,
+    SORT,
+    RENDER,     // cull, sort, upload and draw up to glFinish
+    GPU_UPLOAD,
+    GPU_DRAW,
+    GPU_COMPOSITE,
+    READBACK,
+    ENCODE_PNG,
+    ENCODE_QOI,
+    FRAME,      // ingest to encoded frame
+    COUNT
+};
+constexpr i32 STAGE_COUNT = static_cast<i32>(Stage::COUNT);
+constexpr const char *STAGE_NAMES[STAGE_COUNT] = {
+    "ingest", "cull", "sort", "render", "gpu_upload", "gpu_draw", "gpu_composite", "readback", "encode_png", "encode_qoi", "frame"
+};
+
+struct StageSummary
+{
+    f64 mean_ms;
+    f64 median_ms;
+    f64 min_ms;
+    f64 max_ms;
+};
+
+struct ConfigResult
+{
+    i64 n_particles;
+    i32 width;
+    i32 height;
+    f32 translucent_fraction;
+    f32 camera_distance;
+    std::array<StageSummary, STAGE_COUNT> stages;
+    GpuStats gpu_stats;
+    i64 n_visible;
+    FragmentCounts fragment_counts;
+};
+
+template <typename T, typename Parse>
+std::vector<T> parseList(const char *text, Parse &&parse)
+{
+    std::vector<T> values;
+    std::string list = text;
+    u64 start = 0;
+    while(start <= list.size())
+    {
+        u64 end = list.find(',', start);
+        if(end == std::string::npos)
+            end = list.size();
+        if(end > start)
+            values.push_back(parse(list.substr(start, end - start)));
+        start = end + 1;
+    }
+    return values;
+}
+
+bool parseOptions(i32 argc, char **argv, BenchmarkOptions &options)
+{
+    for(i32 i = 1; i < argc; ++i)
+    {
+        const std::string flag = argv[i];
+        if(i + 1 >= argc)
+        {
+            RENDERER_LOG("Missing a value for %s.", flag.c_str());
+            return false;
+        }
+        const char *value = argv[++i];
+        if(flag == "--counts")
+            options.counts = parseList<i64>(value, [](const std::string &s) { return static_cast<i64>(std::stod(s)); });
+        else if(flag == "--resolutions")
+            options.resolutions = parseList<std::array<i32, 2>>(value, [](const std::string &s)
+            {
+                std::array<i32, 2> resolution = {0, 0};
+                sscanf(s.c_str(), "%dx%d", &resolution[0], &resolution[1]);
+                return resolution;
+            });
+        else if(flag == "--translucent")
+            options.translucent_fractions = parseList<f32>(value, [](const std::string &s) { return std::stof(s); });
+        else if(flag == "--distances")
+            options.camera_distances = parseList<f32>(value, [](const std::string &s) { return std::stof(s); });
+        else if(flag == "--iterations")
+            options.iterations = std::stoi(value);
+        else if(flag == "--warmup")
+            options.warmup = std::stoi(value);
+        else if(flag == "--encode")
+        {
+            const std::string formats = value;
+            options.encode_png = formats.find("png") != std::string::npos;
+            options.encode_qoi = formats.find("qoi") != std::string::npos;
+        }
+        else if(flag == "--sort")
+        {
+            const std::string mode = value;
+            options.sort_mode = mode == "std" ? SortMode::STD_SORT : mode == "gpu" ? SortMode::GPU_BITONIC : mode == "temporal" ? SortMode::TEMPORAL : SortMode::RADIX;
+        }
+        else if(flag == "--blend")
+            options.blend_mode = std::string(value) == "oit" ? BlendMode::WEIGHTED_OIT : BlendMode::SORTED;
+        else if(flag == "--quad")
+            options.quad_path = std::string(value) == "six" ? QuadPath::SIX_VERTEX : QuadPath::INSTANCED_STRIP;
+        else if(flag == "--sphere")
+        {
+            const std::string mode = value;
+            options.sphere_mode = mode == "raycast" ? SphereMode::RAY_CAST : mode == "mesh" ? SphereMode::MESH : SphereMode::FLAT_BILLBOARD;
+        }
+        else if(flag == "--count-fragments")
+            options.count_fragments = std::stoi(value) != 0;
+        else if(flag == "--output")
+            options.output = value;
+        else
+        {
+            RENDERER_LOG("Unknown option %s.", flag.c_str());
+            return false;
+        }
+    }
+    for(const auto &resolution : options.resolutions)
+        if(resolution[0] <= 0 || resolution[1] <= 0)
+            return false;
+    return options.iterations > 0 && options.warmup >= 0;
+}
+
+// A uniform cube of particles with the given fraction translucent, seeded so
+// every run and commit sees the same scene.
+void generateParticles(i64 n_particles, f32 translucent_fraction, std::vector<glmath::Vec3> &positions, std::vector<glmath::Vec4> &colours)
+{
+    std::mt19937 generator(1234);
+    std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+    positions.resize(n_particles);
+    colours.resize(n_particles);
+    for(i64 i = 0; i < n_particles; ++i)
+    {
+        positions[i] = {unit(generator), unit(generator), unit(generator)};
+        const f32 alpha = unit(generator) < translucent_fraction ? 0.3f : 1.0f;
+        colours[i] = {unit(generator), unit(generator), unit(generator), alpha};
+    }
+}
+
+StageSummary summarise(std::vector<f64> samples)
+{
+    if(samples.empty())
+        return {};
+    std::sort(samples.begin(), samples.end());
+    f64 total = 0.0;
+    for(f64 sample : samples)
+        total += sample;
+    return {total / static_cast<f64>(samples.size()), samples[samples.size() / 2], samples.front(), samples.back()};
+}
+
+ConfigResult benchmarkConfig(GlRenderer &gl, const BenchmarkOptions &options, const std::vector<glmath::Vec3> &positions, const std::vector<glmath::Vec4> &colours, i32 width, i32 height, f32 camera_distance)
+{
+    const i64 n_particles = static_cast<i64>(positions.size());
+    // Keeps the cube's coverage roughly constant across particle counts.
+    const f32 radius = 0.6f / std::cbrt(static_cast<f32>(n_particles));
+    const IngestSource position_source = {positions.data(), n_particles, 3, 1, 3, IngestType::F32};
+    const IngestSource colour_source = {colours.data(), n_particles, 4, 1, 4, IngestType::F32};
+
+    gl.setResolution(width, height);
+    gl.camera = {.pos = {0.5f, 0.5f, 0.5f - camera_distance}, .lookat = {0.5f, 0.5f, 0.5f}};
+    std::vector<u8> pixels(static_cast<i64>(width) * height * 3);
+    std::vector<u8> encoded;
+
+    std::array<std::vector<f64>, STAGE_COUNT> samples;
+    ConfigResult result = {};
+    result.n_particles = n_particles;
+    result.width = width;
+    result.height = height;
+    result.camera_distance = camera_distance;
+    result.fragment_counts = {-1, -1};
+    for(i32 iteration = 0; iteration < options.warmup + options.iterations; ++iteration)
+    {
+        std::array<f64, STAGE_COUNT> times = {};
+        const auto frame_start = std::chrono::steady_clock::now();
+
+        auto stage_start = std::chrono::steady_clock::now();
+        setRadius(gl.renderer, radius);
+        ingestParticles(gl.renderer, position_source, colour_source);
+        times[static_cast<i32>(Stage::INGEST)] = millisecondsSince(stage_start);
+
+        stage_start = std::chrono::steady_clock::now();
+        gl.renderFrame();
+        glFinish();
+        times[static_cast<i32>(Stage::RENDER)] = millisecondsSince(stage_start);
+        times[static_cast<i32>(Stage::CULL)] = gl.renderer.cull_stats.cull_ms;
+        times[static_cast<i32>(Stage::SORT)] = gl.renderer.sort_timings.total_ms;
+        // Every frame ends in glFinish, so the stats collected as this frame
+        // began are the previous frame's, which drew the same scene.
+        const GpuStats &gpu_stats = gl.renderer.gpu_profiler.stats;
+        times[static_cast<i32>(Stage::GPU_UPLOAD)] = gpu_stats.pass_ms[static_cast<i32>(GpuPass::UPLOAD)];
+        times[static_cast<i32>(Stage::GPU_DRAW)] = gpu_stats.pass_ms[static_cast<i32>(GpuPass::DRAW)];
+        times[static_cast<i32>(Stage::GPU_COMPOSITE)] = gpu_stats.pass_ms[static_cast<i32>(GpuPass::COMPOSITE)];
+
+        stage_start = std::chrono::steady_clock::now();
+        gl.readFrameRGB(pixels.data(), false);
+        times[static_cast<i32>(Stage::READBACK)] = millisecondsSince(stage_start);
+
+        if(options.encode_png)
+        {
+            stage_start = std::chrono::steady_clock::now();
+            i32 png_bytes = 0;
+            u8 *png = stbi_write_png_to_mem(pixels.data(), width * 3, width, height, 3, &png_bytes);
+            RENDERER_ASSERT(png != nullptr, "PNG encoding failed.");
+            free(png);
+            times[static_cast<i32>(Stage::ENCODE_PNG)] = millisecondsSince(stage_start);
+        }
+        if(options.encode_qoi)
+        {
+            stage_start = std::chrono::steady_clock::now();
+            qoiEncodeRGB(pixels.data(), width, height, true, encoded);
+            times[static_cast<i32>(Stage::ENCODE_QOI)] = millisecondsSince(stage_start);
+        }
+        times[static_cast<i32>(Stage::FRAME)] = millisecondsSince(frame_start);
+
+        if(iteration < options.warmup)
+            continue;
+        for(i32 stage = 0; stage < STAGE_COUNT; ++stage)
+            samples[stage].push_back(times[stage]);
+        result.gpu_stats = gpu_stats;
+        result.n_visible = gl.renderer.cull_stats.n_visible;
+        // Read outside the timed stages; counting itself slows the draw.
+        if(options.count_fragments)
+            result.fragment_counts = readFragmentCounts(gl.renderer);
+    }
+    for(i32 stage = 0; stage < STAGE_COUNT; ++stage)
+        result.stages[stage] = summarise(samples[stage]);
+    return result;
+}
+
+void writeJsonString(FILE *file, const char *text)
+{
+    fputc('"', file);
+    for(const char *c = text; *c != '\0'; ++c)
+    {
+        if(*c == '"' || *c == '\\')
+            fputc('\\', file);
+        if(static_cast<u8>(*c) >= 0x20)
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+bool writeResults(const BenchmarkOptions &options, const std::vector<ConfigResult> &results)
+{
+    FILE *file = fopen(options.output.c_str(), "w");
+    if(file == nullptr)
+        return false;
+    char timestamp[32];
+    const time_t now = time(nullptr);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(file, "{\n  \"timestamp\": \"%s\",\n  \"gl_renderer\": ", timestamp);
+    writeJsonString(file, reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+    fprintf(file, ",\n  \"gl_version\": ");
+    writeJsonString(file, reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+    fprintf(file, ",\n  \"iterations\": %d,\n  \"warmup\": %d,\n  \"sort_mode\": %u,\n  \"blend_mode\": %u,\n  \"quad_path\": %u,\n  \"sphere_mode\": %u,\n  \"results\": [\n",
+            options.iterations, options.warmup, static_cast<u32>(options.sort_mode), static_cast<u32>(options.blend_mode), static_cast<u32>(options.quad_path), static_cast<u32>(options.sphere_mode));
+    for(u64 r = 0; r < results.size(); ++r)
+    {
+        const ConfigResult &result = results[r];
+        fprintf(file, "    {\n      \"n_particles\": %lld, \"width\": %d, \"height\": %d, \"translucent_fraction\": %g, \"camera_distance\": %g, \"n_visible\": %lld,\n",
+                result.n_particles, result.width, result.height, result.translucent_fraction, result.camera_distance, result.n_visible);
+        // Overdraw is fragments shaded per pixel of the frame; -1 without pipeline statistics.
+        const i64 fragments = result.gpu_stats.counters[static_cast<i32>(GpuCounter::FRAGMENT_SHADER_INVOCATIONS)];
+        const f64 overdraw = fragments < 0 ? -1.0 : static_cast<f64>(fragments) / (static_cast<f64>(result.width) * result.height);
+        fprintf(file, "      \"samples_passed\": %lld, \"fragment_shader_invocations\": %lld, \"vertex_shader_invocations\": %lld, \"overdraw\": %.3f,\n",
+                result.gpu_stats.counters[static_cast<i32>(GpuCounter::SAMPLES_PASSED)], fragments,
+                result.gpu_stats.counters[static_cast<i32>(GpuCounter::VERTEX_SHADER_INVOCATIONS)], overdraw);
+        // Particle fragments shaded and discarded, -1 unless --count-fragments 1.
+        fprintf(file, "      \"shaded_fragments\": %lld, \"discarded_fragments\": %lld,\n      \"stages\": {\n",
+                result.fragment_counts.n_shaded, result.fragment_counts.n_discarded);
+        for(i32 stage = 0; stage < STAGE_COUNT; ++stage)
+        {
+            const StageSummary &summary = result.stages[stage];
+            fprintf(file, "        \"%s\": {\"mean_ms\": %.4f, \"median_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f}%s\n",
+                    STAGE_NAMES[stage], summary.mean_ms, summary.median_ms, summary.min_ms, summary.max_ms, stage + 1 < STAGE_COUNT ? "," : "");
+        }
+        fprintf(file, "      }\n    }%s\n", r + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    BenchmarkOptions options;
+    if(!parseOptions(argc, argv, options))
+    {
+        RENDERER_LOG("usage: render_benchmark [--counts 1e3,1e5] [--resolutions 640x480,1920x1080] [--translucent 0,0.5,1] "
+                     "[--distances 1,2,4] [--iterations 10] [--warmup 2] [--encode png,qoi] [--sort radix|std|gpu|temporal] [--blend sorted|oit] [--quad six|strip] [--sphere flat|raycast|mesh] [--count-fragments 0|1] [--output file.json]");
+        return 1;
+    }
+
+    GlRenderer gl(options.resolutions.front()[0], options.resolutions.front()[1]);
+    gl.setSortMode(options.sort_mode);
+    gl.setBlendMode(options.blend_mode);
+    gl.setQuadPath(options.quad_path);
+    gl.setSphereMode(options.sphere_mode);
+    gl.setFragmentCounting(options.count_fragments);
+    gl.setGpuProfiling(true);
+
+    std::vector<ConfigResult> results;
+    std::vector<glmath::Vec3> positions;
+    std::vector<glmath::Vec4> colours;
+    for(i64 n_particles : options.counts)
+    {
+        for(f32 translucent_fraction : options.translucent_fractions)
+        {
+            generateParticles(n_particles, translucent_fraction, positions, colours);
+            for(const auto &resolution : options.resolutions)
+            {
+                for(f32 camera_distance : options.camera_distances)
+                {
+                    ConfigResult result = benchmarkConfig(gl, options, positions, colours, resolution[0], resolution[1], camera_distance);
+                    result.translucent_fraction = translucent_fraction;
+                    const StageSummary &frame = result.stages[static_cast<i32>(Stage::FRAME)];
+                    RENDERER_LOG("%lld particles, %dx%d, %.2f translucent, distance %.1f: frame %.3f ms (median %.3f)",
+                                 n_particles, resolution[0], resolution[1], translucent_fraction, camera_distance, frame.mean_ms, frame.median_ms);
+                    results.push_back(result);
+                }
+            }
+        }
+    }
+
+    if(!writeResults(options, results))
+    {
+        RENDERER_LOG("Couldn't write %s.", options.output.c_str());
+        return 1;
+    }
+    RENDERER_LOG("Wrote %s.", options.output.c_str());
+    return 0;
+}
@@ -18,14 +18,7 @@ fi
 
 mkdir -p $build_dir
 
-pushd $build_dir
-ln -sf ../../src/shaders/vertexShader.glsl .
-ln -sf ../../src/shaders/fragmentShader.glsl .
-
-objcopy --input binary --output elf64-x86-64 --binary-architecture i386:x86-64 vertexShader.glsl vertex_shader_data.o
-objcopy --input binary --output elf64-x86-64 --binary-architecture i386:x86-64 fragmentShader.glsl fragment_shader_data.o
-popd
-
+# CMake embeds the shaders itself.
 
 cmake -S . -B $build_dir -DPython_EXECUTABLE=$python_dir -DDISPLAY_TYPE:STRING=$1
 
@@ -16,11 +16,11 @@ else
 fi
 
 if [[ $1 == "X11" ]]; then
-    linkerFlags="-lX11 -lGL"
+    linkerFlags="-lX11 -lGL -pthread"
     files_to_compile="../../src/glrendererX11.cpp ../../src/external/glad.c ../../src/external/glad_glx.c"
     executable_name="rendererX11"
 elif [[ $1 == "EGL" ]]; then
-    linkerFlags="-lGL -lEGL -ldl"
+    linkerFlags="-lGL -lEGL -ldl -pthread"
     files_to_compile="../../src/glrendererEGL.cpp ../../src/external/glad.c ../../src/external/glad_egl.c"
     executable_name="rendererEGL"
 else
@@ -33,10 +33,12 @@ pushd "$build_directory"
 
 ln -sf ../../src/shaders/vertexShader.glsl .
 ln -sf ../../src/shaders/fragmentShader.glsl .
+ln -sf ../../src/shaders/depthSortCS.glsl .
 
 objcopy --input binary --output elf64-x86-64 --binary-architecture i386:x86-64 vertexShader.glsl vertex_shader_data.o
 objcopy --input binary --output elf64-x86-64 --binary-architecture i386:x86-64 fragmentShader.glsl fragment_shader_data.o
+objcopy --input binary --output elf64-x86-64 --binary-architecture i386:x86-64 depthSortCS.glsl depth_sort_cs_data.o
 
-g++ $compiler_flags $files_to_compile vertex_shader_data.o fragment_shader_data.o -o "$executable_name" $linkerFlags
+g++ $compiler_flags $files_to_compile vertex_shader_data.o fragment_shader_data.o depth_sort_cs_data.o -o "$executable_name" $linkerFlags
 
 popd
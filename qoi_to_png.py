@@ -0,0 +1,44 @@
+import os
+import sys
+from concurrent.futures import ThreadPoolExecutor
+
+sys.path.insert(0, "build/EGL")
+from glrendererEGL import convertQoiToPng
+
+# Converts frames saved with ImageFormat.QOI to PNG next to the originals.
+# Arguments are .qoi files or directories to search for them. The conversion
+# releases the GIL, so frames are converted on all cores.
+#
+#   python qoi_to_png.py frames/
+
+
+def qoiPaths(arguments):
+    for argument in arguments:
+        if os.path.isdir(argument):
+            for name in sorted(os.listdir(argument)):
+                if name.endswith(".qoi"):
+                    yield os.path.join(argument, name)
+        else:
+            yield argument
+
+
+def convert(qoi_path):
+    png_path = os.path.splitext(qoi_path)[0] + ".png"
+    return qoi_path, convertQoiToPng(qoi_path, png_path)
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: python qoi_to_png.py <file.qoi | directory>...")
+        return 1
+    n_failed = 0
+    with ThreadPoolExecutor(max_workers=os.cpu_count()) as pool:
+        for qoi_path, converted in pool.map(convert, qoiPaths(sys.argv[1:])):
+            if not converted:
+                print(f"Failed to convert {qoi_path}")
+                n_failed += 1
+    return 1 if n_failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
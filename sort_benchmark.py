@@ -0,0 +1,54 @@
+import sys
+import time
+import numpy as np
+
+sys.path.insert(0, "build/EGL")
+from glrendererEGL import GlRenderer, SortMode, ParticleLayout
+
+# Compares the CPU radix sort with the GPU bitonic sort on random particle
+# clouds. Frame times include upload, draw and readback; the sort columns are
+# the CPU time of sortParticlesByDepth and the GPU timer of the compute sort.
+
+WIDTH, HEIGHT = 512, 512
+PARTICLE_COUNTS = [10_000, 100_000, 1_000_000]
+FRAMES = 10
+WARMUP_FRAMES = 2
+
+
+def benchmark(renderer, positions, colours, sort_mode):
+    renderer.setSortMode(sort_mode)
+    frame_ms, cpu_sort_ms, gpu_sort_ms = [], [], []
+    image = np.empty((HEIGHT, WIDTH, 3), dtype=np.uint8)
+    for frame in range(WARMUP_FRAMES + FRAMES):
+        frame_start = time.perf_counter()
+        renderer.particles(positions, colours, 0.005)
+        renderer.getImageRGB(out=image)
+        frame_end = time.perf_counter()
+        if frame < WARMUP_FRAMES:
+            continue
+        timings = renderer.getSortTimings()
+        frame_ms.append((frame_end - frame_start) * 1000.0)
+        cpu_sort_ms.append(timings["total_ms"])
+        gpu_sort_ms.append(timings["gpu_sort_ms"])
+    return np.median(frame_ms), np.median(cpu_sort_ms), np.median(gpu_sort_ms)
+
+
+def main():
+    renderer = GlRenderer(WIDTH, HEIGHT)
+    renderer.setCamera(np.array([0.5, 0.5, -2.0], dtype=np.float32), np.array([0.5, 0.5, 0.5], dtype=np.float32))
+    rng = np.random.default_rng(20)
+
+    print(f"{'layout':>12} {'particles':>10} {'sort':>12} {'frame ms':>10} {'cpu sort ms':>12} {'gpu sort ms':>12}")
+    for layout in [ParticleLayout.INTERLEAVED, ParticleLayout.COMPACT]:
+        renderer.setParticleLayout(layout)
+        for n_particles in PARTICLE_COUNTS:
+            positions = rng.random((n_particles, 3), dtype=np.float32)
+            colours = rng.random((n_particles, 4), dtype=np.float32)
+            colours[:, 3] = 0.5
+            for sort_mode in [SortMode.RADIX, SortMode.GPU_BITONIC]:
+                frame_ms, cpu_sort_ms, gpu_sort_ms = benchmark(renderer, positions, colours, sort_mode)
+                print(f"{layout.name:>12} {n_particles:>10} {sort_mode.name:>12} {frame_ms:>10.2f} {cpu_sort_ms:>12.2f} {gpu_sort_ms:>12.2f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -6,6 +6,7 @@
 #include <cassert>
 #include <cstring>
 #include <cstddef>
+#include <bit>
 
 
 
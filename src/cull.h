@@ -0,0 +1,112 @@
+#ifndef CULL_H
+#define CULL_H
+
+#include "defintions.h"
+#include "glmath.h"
+#include <cmath>
+#include <bit>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+// Planes a*x + b*y + c*z + d >= 0 bounding the view volume, normals facing in
+// and normalised so that the plane equation is a signed distance.
+struct Frustum
+{
+    f32 planes[6][4];
+};
+
+// Gribb-Hartmann extraction: with rows r0..r3 of projection * view, a point is
+// inside the GL clip volume when -w <= x, y, z <= w, i.e. (r3 +- ri) . p >= 0.
+Frustum frustumFromViewProjection(const glmath::Mat4x4 &view_projection)
+{
+    Frustum frustum;
+    for(i32 axis = 0; axis < 3; ++axis)
+    {
+        for(i32 side = 0; side < 2; ++side)
+        {
+            f32 *plane = frustum.planes[axis * 2 + side];
+            const f32 sign = side == 0 ? 1.0f : -1.0f;
+            for(i32 column = 0; column < 4; ++column)
+                plane[column] = view_projection.data[column][3] + sign * view_projection.data[column][axis];
+            const f32 length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+            for(i32 column = 0; column < 4; ++column)
+                plane[column] /= length;
+        }
+    }
+    return frustum;
+}
+
+inline bool sphereInFrustum(const Frustum &frustum, const f32 *centre, f32 radius)
+{
+    for(const auto &plane : frustum.planes)
+    {
+        if(plane[0] * centre[0] + plane[1] * centre[1] + plane[2] * centre[2] + plane[3] < -radius)
+            return false;
+    }
+    return true;
+}
+
+#if defined(__SSE2__)
+// Bitmask of which of the four spheres given as SoA centres overlap the frustum.
+inline i32 spheresInFrustum4(const Frustum &frustum, __m128 x, __m128 y, __m128 z, __m128 neg_radius)
+{
+    __m128 outside = _mm_setzero_ps();
+    for(const auto &plane : frustum.planes)
+    {
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane[0])), _mm_mul_ps(y, _mm_set1_ps(plane[1]))),
+                                     _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane[2])), _mm_set1_ps(plane[3])));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, neg_radius));
+    }
+    return ~_mm_movemask_ps(outside) & 0xF;
+}
+#endif
+
+// Sets visible[i] to 1 for the spheres [begin, end) that overlap the frustum and
+// 0 otherwise, returning how many are visible. Centres are xyz at
+// positions + i * stride; stride 3 is a tightly packed stream, anything wider
+// must leave at least one readable float after z.
+i64 cullSpheres(const Frustum &frustum, const f32 *positions, i64 stride, f32 radius, i64 begin, i64 end, u8 *visible)
+{
+    i64 n_visible = 0;
+    i64 i = begin;
+#if defined(__SSE2__)
+    const __m128 neg_radius = _mm_set1_ps(-radius);
+    for(; i + 4 <= end; i += 4)
+    {
+        __m128 x, y, z;
+        if(stride == 3)
+        {
+            const f32 *p = positions + i * 3;
+            __m128 a = _mm_loadu_ps(p);     // x0 y0 z0 x1
+            __m128 b = _mm_loadu_ps(p + 4); // y1 z1 x2 y2
+            __m128 c = _mm_loadu_ps(p + 8); // z2 x3 y3 z3
+            x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+            y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+            z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+        }
+        else
+        {
+            x = _mm_loadu_ps(positions + i * stride);
+            y = _mm_loadu_ps(positions + (i + 1) * stride);
+            z = _mm_loadu_ps(positions + (i + 2) * stride);
+            __m128 w = _mm_loadu_ps(positions + (i + 3) * stride);
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+        }
+        const i32 mask = spheresInFrustum4(frustum, x, y, z, neg_radius);
+        for(i32 lane = 0; lane < 4; ++lane)
+            visible[i + lane] = (mask >> lane) & 1;
+        n_visible += std::popcount(static_cast<u32>(mask));
+    }
+#endif
+    for(; i < end; ++i)
+    {
+        visible[i] = sphereInFrustum(frustum, positions + i * stride, radius);
+        n_visible += visible[i];
+    }
+    return n_visible;
+}
+
+#endif
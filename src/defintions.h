@@ -40,7 +40,7 @@ STATIC_ASSERT(sizeof(f64) == 8, "Expected f64 to be 8 bytes.");
 
 
 
-void getTime(char *buffer, i32 max_length)
+inline void getTime(char *buffer, i32 max_length)
 {
 
     time_t t = time(NULL);
@@ -85,7 +85,7 @@ inline void rendererLogFile(const char *format, ...)
 }
 #define RENDERER_LOG(...) rendererLogConsole(__VA_ARGS__)
 
-void logFileIfFailed(bool err, const char* file, int line, const char *format, ...)
+inline void logFileIfFailed(bool err, const char* file, int line, const char *format, ...)
 {
     if (!err)
     {
@@ -112,7 +112,7 @@ void logFileIfFailed(bool err, const char* file, int line, const char *format, .
 }
 
 
-void logConsoleIfFailed(bool err, const char* file, int line, const char *format, ...)
+inline void logConsoleIfFailed(bool err, const char* file, int line, const char *format, ...)
 {
     if (!err)
     {
@@ -0,0 +1,62 @@
+#include "egl_context.h"
+#include "glextensions.h"
+
+SurfaceState createSurfaceAndContext(i32 client_width, i32 client_height)
+{
+  static const EGLint attribute_list[] = {
+          EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+          EGL_BLUE_SIZE, 8,
+          EGL_GREEN_SIZE, 8,
+          EGL_RED_SIZE, 8,
+          EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+          EGL_NONE
+  };    
+    EGLint offscreen_buffer_attributes[] = {EGL_HEIGHT, 1, EGL_WIDTH, 1,EGL_NONE};
+
+    gladLoadEGL();
+    eglBindAPI(EGL_OPENGL_API);
+
+    static const int MAX_DEVICES = 20;
+    EGLDeviceEXT devices[MAX_DEVICES];
+    EGLint numDevices;
+    eglQueryDevicesEXT(MAX_DEVICES, devices, &numDevices);
+
+    
+    RENDERER_LOG("Found %d device(s)\n", numDevices);
+    for (int i = 0; i < numDevices; i++) {
+        const char *vendor = eglQueryDeviceStringEXT(devices[i], EGL_VENDOR);
+        const char *extensions = eglQueryDeviceStringEXT(devices[i], EGL_EXTENSIONS);
+        RENDERER_LOG("Device %d vendor: %s\n", i, vendor ? vendor : "unknown");
+        RENDERER_LOG("Device %d extensions: %s\n", i, extensions ? extensions : "unknown");
+    }
+
+    EGLDisplay connection = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, devices[0], 0);
+
+    // EGLDisplay connection = eglGetDisplay(eglDpy);
+
+    RENDERER_ASSERT(connection != EGL_NO_DISPLAY, "EGL couldn't find any valid display connections.");
+
+    EGLBoolean initalisationSuccess = eglInitialize(connection, NULL, NULL);
+    RENDERER_ASSERT(initalisationSuccess == EGL_TRUE, "Couldn't initialise EGL.");
+
+    EGLConfig config;
+    i32 num_config;
+    eglChooseConfig(connection, attribute_list, &config, 1, &num_config);
+    RENDERER_ASSERT(num_config > 0, "Chosen display connection doesn't support rendering config.");
+
+    EGLContext context = eglCreateContext(connection, config, EGL_NO_CONTEXT, NULL);
+    RENDERER_ASSERT(context != EGL_NO_CONTEXT, "Couldn't crate EGL context.");
+
+    EGLSurface offscreen_surface = eglCreatePbufferSurface(connection,config,offscreen_buffer_attributes);
+    RENDERER_ASSERT(offscreen_surface != EGL_NO_SURFACE, "Can't create an offscreen surface.");
+
+    
+    EGLBoolean context_creation_success = eglMakeCurrent(connection, offscreen_surface, offscreen_surface, context);
+    RENDERER_ASSERT(context_creation_success, "Coudn't make EGL context current.");
+
+    i32 glad_load_success = gladLoadGLLoader((GLADloadproc)eglGetProcAddress);
+    RENDERER_ASSERT(glad_load_success, "Couln't load EGL functions.");
+    loadGlExtensions((GLADloadproc)eglGetProcAddress);
+
+    return {connection, offscreen_surface,client_width, client_height};
+}
@@ -0,0 +1,23 @@
+#ifndef EGL_CONTEXT_H
+#define EGL_CONTEXT_H
+
+#include "defintions.h"
+#include "external/glad/glad.h"
+#include "external/glad/glad_egl.h"
+
+// client_width x client_height is the output resolution. Frames are drawn
+// into the renderer's RenderTarget rather than the pbuffer, which only exists
+// to make the context current, so it can change between frames.
+struct SurfaceState
+{
+    EGLDisplay connection;    
+    EGLSurface surface;
+    i32 client_width;
+    i32 client_height;
+};
+
+// Makes an OpenGL context on the first EGL device current on the calling
+// thread, with a 1 x 1 pbuffer, and loads GL and its extensions.
+SurfaceState createSurfaceAndContext(i32 client_width, i32 client_height);
+
+#endif
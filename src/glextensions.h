@@ -0,0 +1,81 @@
+#ifndef GLEXTENSIONS_H
+#define GLEXTENSIONS_H
+
+#include "defintions.h"
+#include "external/glad/glad.h"
+#include <cstring>
+
+// The bundled glad loader only covers core GL 4.3. Entry points the renderer
+// can use when the driver offers more are loaded here and left null otherwise,
+// so every caller has to keep a 4.3 fallback.
+
+// GL 4.4 / ARB_buffer_storage
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_DYNAMIC_STORAGE_BIT
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#endif
+#ifndef GL_CLIENT_STORAGE_BIT
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#endif
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+// GL 4.6 / ARB_pipeline_statistics_query, query targets only
+#ifndef GL_VERTEX_SHADER_INVOCATIONS
+#define GL_VERTEX_SHADER_INVOCATIONS 0x82F0
+#endif
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS
+#define GL_FRAGMENT_SHADER_INVOCATIONS 0x82F4
+#endif
+#ifndef GL_CLIPPING_INPUT_PRIMITIVES
+#define GL_CLIPPING_INPUT_PRIMITIVES 0x82F6
+#endif
+
+
+struct GlExtensions
+{
+    i32 major_version;
+    i32 minor_version;
+
+    PFNGLBUFFERSTORAGEPROC bufferStorage;
+    bool pipeline_statistics;
+};
+
+inline GlExtensions gl_extensions = {};
+
+
+inline bool hasGlExtension(const char *name)
+{
+    i32 n_extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &n_extensions);
+    for(i32 i = 0; i < n_extensions; ++i)
+    {
+        const char *extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if(extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+inline bool glVersionAtLeast(i32 major, i32 minor)
+{
+    return gl_extensions.major_version > major || (gl_extensions.major_version == major && gl_extensions.minor_version >= minor);
+}
+
+// Must be called with a current context, after gladLoadGLLoader.
+inline void loadGlExtensions(GLADloadproc load)
+{
+    gl_extensions = {};
+    glGetIntegerv(GL_MAJOR_VERSION, &gl_extensions.major_version);
+    glGetIntegerv(GL_MINOR_VERSION, &gl_extensions.minor_version);
+
+    if(glVersionAtLeast(4, 4) || hasGlExtension("GL_ARB_buffer_storage"))
+        gl_extensions.bufferStorage = reinterpret_cast<PFNGLBUFFERSTORAGEPROC>(load("glBufferStorage"));
+    gl_extensions.pipeline_statistics = glVersionAtLeast(4, 6) || hasGlExtension("GL_ARB_pipeline_statistics_query");
+}
+
+#endif
@@ -9,7 +9,7 @@ namespace glmath
 {
 
     constexpr f32 PI = 3.14159265359f; //use std numerics instead
-    bool approxEqual(f32 v1, f32 v2, f32 eps)
+    inline bool approxEqual(f32 v1, f32 v2, f32 eps)
     {
         return (abs(v1 - v2) < eps);
     }
@@ -63,7 +63,7 @@ namespace glmath
     // Vec3 constructors
     constexpr Vec3::Vec3(f32 xp, f32 yp, f32 zp) : x(xp), y(yp), z(zp) {};
     constexpr Vec3::Vec3(f32 v) : x(v), y(v), z(v) {}
-    Vec3::Vec3(const Vec4& v) : x(v.x), y(v.y), z(v.z) {}
+    inline Vec3::Vec3(const Vec4& v) : x(v.x), y(v.y), z(v.z) {}
 
     // Vec4 constructors
     constexpr Vec4::Vec4(f32 xp, f32 yp, f32 zp, f32 wp) : x(xp), y(yp), z(zp), w(wp) {};
@@ -73,59 +73,59 @@ namespace glmath
 
 
     //Vec3 operators
-    Vec3 operator/(const Vec3 &lhs,const f32 &rhs )
+    inline Vec3 operator/(const Vec3 &lhs,const f32 &rhs )
     {
         return {lhs.x / rhs,
                 lhs.y / rhs,
                 lhs.z / rhs,
                 };
     }
-    Vec3 operator+(const Vec3 &lhs,const Vec3 &rhs )
+    inline Vec3 operator+(const Vec3 &lhs,const Vec3 &rhs )
     {
         return {lhs.x + rhs.x,
                 lhs.y + rhs.y,
                 lhs.z + rhs.z,
                 };
     }
-    void operator+=(Vec3 &v1,const Vec3 &v2 )
+    inline void operator+=(Vec3 &v1,const Vec3 &v2 )
     {
         v1.x += v2.x;
         v1.y += v2.y;
         v1.z += v2.z;
     }
-    Vec3 operator-(const Vec3 &lhs,const Vec3 &rhs )
+    inline Vec3 operator-(const Vec3 &lhs,const Vec3 &rhs )
     {
         return {lhs.x - rhs.x,
                 lhs.y - rhs.y,
                 lhs.z - rhs.z,
                 };
     }
-    Vec3 operator-(const Vec3 &vec )
+    inline Vec3 operator-(const Vec3 &vec )
     {
         return {-vec.x, -vec.y, -vec.z};
     }
 
-    Vec3 operator*(const Vec3 &vec, f32 scale )
+    inline Vec3 operator*(const Vec3 &vec, f32 scale )
     {
         return {vec.x * scale, vec.y * scale, vec.z * scale};
     }
-    Vec3 operator*(f32 scale, const Vec3 &vec)
+    inline Vec3 operator*(f32 scale, const Vec3 &vec)
     {
         return {vec.x * scale, vec.y * scale, vec.z * scale};
     }
-    f32 dot(const Vec3 &v1, const Vec3 &v2)
+    inline f32 dot(const Vec3 &v1, const Vec3 &v2)
     {
         return v1.x * v2.x +  v1.y * v2.y +  v1.z * v2.z;
     }
-    Vec3 normalise(const Vec3 &v)
+    inline Vec3 normalise(const Vec3 &v)
     {
         return ( v / sqrt(dot(v,v)));
     }
-    f32 norm(const Vec3 &v)
+    inline f32 norm(const Vec3 &v)
     {
         return sqrt(dot(v,v));
     }
-    Vec3 cross(const Vec3 &v1,const Vec3 &v2 )
+    inline Vec3 cross(const Vec3 &v1,const Vec3 &v2 )
     {
         Vec3 result;
         result.x = v1.y*v2.z - v1.z*v2.y;
@@ -133,7 +133,7 @@ namespace glmath
         result.z = v1.x*v2.y - v1.y*v2.x;
         return result;
     }
-    Vec3 operator/(const Vec3 &v, f32 q)
+    inline Vec3 operator/(const Vec3 &v, f32 q)
     {
         Vec3 result;
         result.x = v.x / q;
@@ -146,7 +146,7 @@ namespace glmath
 
 
     // Vec4 operators
-    Vec4 operator+(const Vec4 &lhs,const Vec4 &rhs )
+    inline Vec4 operator+(const Vec4 &lhs,const Vec4 &rhs )
     {
         return {lhs.x + rhs.x,
                 lhs.y + rhs.y,
@@ -181,47 +181,47 @@ namespace glmath
         Vec2(f32 v) : x(v), y(v) {};
     };
 
-    Vec2 operator+(const Vec2 &lhs,const Vec2 &rhs )
+    inline Vec2 operator+(const Vec2 &lhs,const Vec2 &rhs )
     {
         return {lhs.x + rhs.x,
                 lhs.y + rhs.y,
                 };
     }
-    void operator+=(Vec2 &v1,const Vec2 &v2 )
+    inline void operator+=(Vec2 &v1,const Vec2 &v2 )
     {
         v1.x += v2.x;
         v1.y += v2.y;
     }
-    Vec2 operator-(const Vec2 &lhs,const Vec2 &rhs )
+    inline Vec2 operator-(const Vec2 &lhs,const Vec2 &rhs )
     {
         return {lhs.x - rhs.x,
                 lhs.y - rhs.y,
                 };
     }
-    Vec2 operator-(const Vec2 &vec )
+    inline Vec2 operator-(const Vec2 &vec )
     {
         return {-vec.x, -vec.y};
     }
 
-    Vec2 operator*(const Vec2 &vec, f32 scale )
+    inline Vec2 operator*(const Vec2 &vec, f32 scale )
     {
         return {vec.x * scale, vec.y * scale};
     }
-    Vec2 operator*(f32 scale, const Vec2 &vec)
+    inline Vec2 operator*(f32 scale, const Vec2 &vec)
     {
         return {vec.x * scale, vec.y * scale};
     }
 
-    f32 dot(const Vec2 &v1, const Vec2 &v2)
+    inline f32 dot(const Vec2 &v1, const Vec2 &v2)
     {
         return v1.x * v2.x +  v1.y * v2.y;
     }
-    f32 norm(const Vec2 &v)
+    inline f32 norm(const Vec2 &v)
     {
         return sqrt(dot(v,v));
     }
 
-    Vec2 operator/(const Vec2 &v, f32 q)
+    inline Vec2 operator/(const Vec2 &v, f32 q)
     {
         Vec2 result;
         result.x = v.x / q;
@@ -261,7 +261,7 @@ namespace glmath
     };
 
     //Angle is in radians
-    Mat3x3 rotateY(f32 angle)
+    inline Mat3x3 rotateY(f32 angle)
     {
         Mat3x3 result;
         result.data[0][0] = cos(angle);
@@ -283,7 +283,7 @@ namespace glmath
 
 
 
-    Vec3 operator*(const Mat3x3 &mat, const Vec3 & vec)
+    inline Vec3 operator*(const Mat3x3 &mat, const Vec3 & vec)
     {
         Vec3 result;
         result.x = mat.data[0][0] * vec.x + mat.data[1][0] * vec.y + mat.data[2][0] *vec.z;
@@ -330,7 +330,7 @@ namespace glmath
  
     };
 
-    Mat4x4 transpose(const Mat4x4 &mat)
+    inline Mat4x4 transpose(const Mat4x4 &mat)
     {
         Mat4x4 result;
         result.data[0][0] = mat.data[0][0];
@@ -379,7 +379,7 @@ namespace glmath
 
 
 
-    Mat4x4 operator*(const Mat4x4 &m1, const Mat4x4 &m2)
+    inline Mat4x4 operator*(const Mat4x4 &m1, const Mat4x4 &m2)
     {
         Mat4x4 result;
         result.data[0][0] = m1.data[0][0] * m2.data[0][0] + m1.data[1][0] * m2.data[0][1] +
@@ -424,7 +424,7 @@ namespace glmath
 
 
 
-    Mat4x4 viewMatrix(const Vec3 &forwardBasis, const Vec3 &rightBasis,const Vec3 &upBasis, const Vec3 &pos)
+    inline Mat4x4 viewMatrix(const Vec3 &forwardBasis, const Vec3 &rightBasis,const Vec3 &upBasis, const Vec3 &pos)
     {
         Mat4x4 result;
 
@@ -451,7 +451,7 @@ namespace glmath
         return result;
     }
 
-    Mat4x4 lookAt(const Vec3 &camera_pos, const Vec3 &target, const Vec3 &global_up)
+    inline Mat4x4 lookAt(const Vec3 &camera_pos, const Vec3 &target, const Vec3 &global_up)
     {
         Vec3 forward = normalise(target - camera_pos);
         Vec3 right = normalise(cross(global_up, forward));
@@ -462,7 +462,7 @@ namespace glmath
     
     // LHS projection that looks down the +z axis stored in column-major
     // Takes the vertical FOV in radians
-    Mat4x4 perspectiveProjection(f32 verticalFOV, f32  aspectRatio, f32 nearPlane, f32 farPlane)
+    inline Mat4x4 perspectiveProjection(f32 verticalFOV, f32  aspectRatio, f32 nearPlane, f32 farPlane)
     {
         f32 c = 1.0f / tan(verticalFOV / 2.0f);
         Mat4x4 result;
@@ -489,7 +489,7 @@ namespace glmath
     }
 
 
-    Vec4 operator*(const Mat4x4 &mat, const Vec4 & vec)
+    inline Vec4 operator*(const Mat4x4 &mat, const Vec4 & vec)
     {
         Vec4 result;
         result.x = mat.data[0][0] * vec.x + mat.data[1][0] * vec.y + mat.data[2][0] *vec.z + mat.data[3][0] *vec.w;
@@ -500,7 +500,7 @@ namespace glmath
     }
 
 
-    Mat4x4 translate(f32 xTranslate, f32 yTranslate, f32 zTranslate)
+    inline Mat4x4 translate(f32 xTranslate, f32 yTranslate, f32 zTranslate)
     {
         Mat4x4 result;
         result.data[0][0] = 1.0;
@@ -524,13 +524,13 @@ namespace glmath
         result.data[3][3] = 1.0;
         return result;
     }
-    Mat4x4 translate(glmath::Vec3 transform)
+    inline Mat4x4 translate(glmath::Vec3 transform)
     {
         return translate(transform.x,transform.y,transform.z);
     }
 
 
-    Mat4x4 scale(f32 xScale, f32 yScale, f32 zScale)
+    inline Mat4x4 scale(f32 xScale, f32 yScale, f32 zScale)
     {
         Mat4x4 result;
         result.data[0][0] = xScale;
@@ -555,7 +555,7 @@ namespace glmath
         return result;
     }
 
-    Mat4x4 scale(Vec3 transform)
+    inline Mat4x4 scale(Vec3 transform)
     {
         return scale(transform.x, transform.y, transform.z);
     }
@@ -563,7 +563,7 @@ namespace glmath
 
 
 
-    Mat4x4 identity()
+    inline Mat4x4 identity()
     {
         Mat4x4 result;
         result.data[0][0] = 1.0;
@@ -590,7 +590,7 @@ namespace glmath
 
     // angle must be in radians
     // axis must be a unit vector
-    Mat4x4 rotateAroundAxis(f32 angle,const Vec3& u)
+    inline Mat4x4 rotateAroundAxis(f32 angle,const Vec3& u)
     {
         f32 c = cos(angle);
         f32 s = sin(angle);
@@ -642,7 +642,7 @@ namespace glmath
 
     
 
-    Quaternion operator*(const Quaternion &q1, const Quaternion &q2)
+    inline Quaternion operator*(const Quaternion &q1, const Quaternion &q2)
     {
         Quaternion result;
         result.x = q1.x * q2.w + q1.y * q2.z - q1.z * q2.y + q1.w * q2.x;
@@ -653,7 +653,7 @@ namespace glmath
     }
 
 
-    Mat4x4 quaternionToMatrix(const Quaternion &q)
+    inline Mat4x4 quaternionToMatrix(const Quaternion &q)
     {
         Mat4x4 result;
         result.data[0][0] = 1.0f - 2.0f * (q.y * q.y + q.z * q.z);
@@ -679,7 +679,7 @@ namespace glmath
         return result;
     }
 
-    Quaternion eulerAngleToQuaternion(f32 roll, f32 yaw, f32 pitch)
+    inline Quaternion eulerAngleToQuaternion(f32 roll, f32 yaw, f32 pitch)
     {
         f32 cr = cos(roll / 2.0f);
         f32 sr = sin(roll / 2.0f);
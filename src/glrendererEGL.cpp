@@ -7,87 +7,22 @@
 #include <string>
 #include <filesystem>
 #include <vector>
+#include <deque>
 
 #include "external/glad/glad.h"
 #include "external/glad/glad_egl.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "external/stb_image_write.h"
+#include "image_writer.h"
+#include "sequence_writer.h"
 
 #include "defintions.h" 
 #include "glmath.h"
-#include "renderer.cpp"
-
-struct SurfaceState
-{
-    EGLDisplay connection;    
-    EGLSurface surface;
-    i32 client_width;
-    i32 client_height;
-};
-
-SurfaceState createSurfaceAndContext(i32 client_width, i32 client_height)
-{
-  static const EGLint attribute_list[] = {
-          EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
-          EGL_BLUE_SIZE, 8,
-          EGL_GREEN_SIZE, 8,
-          EGL_RED_SIZE, 8,
-          EGL_DEPTH_SIZE, 8,
-          EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
-          EGL_NONE
-  };    
-    EGLint offscreen_buffer_attributes[] = {EGL_HEIGHT, client_height, EGL_WIDTH, client_width,EGL_NONE};
-
-    gladLoadEGL();
-    eglBindAPI(EGL_OPENGL_API);
-
-    static const int MAX_DEVICES = 20;
-    EGLDeviceEXT devices[MAX_DEVICES];
-    EGLint numDevices;
-    eglQueryDevicesEXT(MAX_DEVICES, devices, &numDevices);
-
-    
-    RENDERER_LOG("Found %d device(s)\n", numDevices);
-    for (int i = 0; i < numDevices; i++) {
-        const char *vendor = eglQueryDeviceStringEXT(devices[i], EGL_VENDOR);
-        const char *extensions = eglQueryDeviceStringEXT(devices[i], EGL_EXTENSIONS);
-        RENDERER_LOG("Device %d vendor: %s\n", i, vendor ? vendor : "unknown");
-        RENDERER_LOG("Device %d extensions: %s\n", i, extensions ? extensions : "unknown");
-    }
-
-    EGLDisplay connection = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, devices[0], 0);
-
-    // EGLDisplay connection = eglGetDisplay(eglDpy);
-
-    RENDERER_ASSERT(connection != EGL_NO_DISPLAY, "EGL couldn't find any valid display connections.");
-
-    EGLBoolean initalisationSuccess = eglInitialize(connection, NULL, NULL);
-    RENDERER_ASSERT(initalisationSuccess == EGL_TRUE, "Couldn't initialise EGL.");
-
-    EGLConfig config;
-    i32 num_config;
-    eglChooseConfig(connection, attribute_list, &config, 1, &num_config);
-    RENDERER_ASSERT(num_config > 0, "Chosen display connection doesn't support rendering config.");
-
-    EGLContext context = eglCreateContext(connection, config, EGL_NO_CONTEXT, NULL);
-    RENDERER_ASSERT(context != EGL_NO_CONTEXT, "Couldn't crate EGL context.");
-
-    EGLSurface offscreen_surface = eglCreatePbufferSurface(connection,config,offscreen_buffer_attributes);
-    RENDERER_ASSERT(offscreen_surface != EGL_NO_SURFACE, "Can't create an offscreen surface.");
-
-    
-    EGLBoolean context_creation_success = eglMakeCurrent(connection, offscreen_surface, offscreen_surface, context);
-    RENDERER_ASSERT(context_creation_success, "Coudn't make EGL context current.");
-
-    i32 glad_load_success = gladLoadGLLoader((GLADloadproc)eglGetProcAddress);
-    RENDERER_ASSERT(glad_load_success, "Couln't load EGL functions.");
-
-    return {connection, offscreen_surface,client_width, client_height};
-}
-
-
-
+#include "renderer.h"
+#include "egl_context.h"
+#include "renderer_controls.h"
+#include "threading.h"
 
 struct Camera
 {
@@ -96,11 +31,13 @@ struct Camera
 };
 
 
-struct GlRenderer
+struct GlRenderer : RendererControls
 {
     SurfaceState surface_state;
-    Renderer renderer;
     Camera camera;
+    i32 samples = 1;
+    ColourFormat colour_format = ColourFormat::RGBA8;
+    DepthFormat depth_format = DepthFormat::DEPTH24;
     GlRenderer(i32 width, i32 height)
     {
         RENDERER_LOG("Current Working Directory: %s", std::filesystem::current_path().c_str());
@@ -138,24 +75,87 @@ struct GlRenderer
         RENDERER_LOG(titleBarString);
     }
 
+    glmath::Mat4x4 projection() const
+    {
+        constexpr f32 vertical_fov = 45.0 * glmath::PI / 180.0;
+        constexpr f32 near_plane = 0.1f;
+        constexpr f32 far_plane  = 1000.f;
+        const f32 aspect_ratio = static_cast<f32>(surface_state.client_width) / static_cast<f32>(surface_state.client_height);
+        return glmath::perspectiveProjection(vertical_fov,aspect_ratio,near_plane,far_plane);
+    }
+
+    static glmath::Mat4x4 viewMatrix(const Camera &view_camera)
+    {
+        constexpr glmath::Vec3 up = {0.0, 1.0, 0.0};
+        return glmath::lookAt(view_camera.pos,view_camera.lookat,up);
+    }
+
+    // Culls, sorts and draws the current particles into the render target,
+    // leaving the resolved frame bound for reading.
+    void renderFrame()
+    {
+        cullParticles(renderer, projection() * viewMatrix(camera));
+        sortParticlesByDepth(renderer,camera.pos);
+        drawFrame();
+    }
+
+    // The drawing half of renderFrame, for particles already culled and sorted
+    // from the current camera.
+    void drawFrame()
+    {
+        resizeRenderTarget(renderer.render_target, surface_state.client_width, surface_state.client_height, samples, colour_format, depth_format);
+        bindRenderTarget(renderer.render_target);
+        renderScene(renderer, viewMatrix(camera), projection());
+        resolveRenderTarget(renderer.render_target);
+    }
+
+    // Output size of the frames rendered from now on. Attachments are
+    // recreated on the next frame; frames already in the readback ring keep
+    // their own size.
+    void setResolution(i32 width, i32 height)
+    {
+        RENDERER_ASSERT(width > 0 && height > 0, "Expected a positive resolution, got %d x %d.", width, height);
+        surface_state.client_width = width;
+        surface_state.client_height = height;
+    }
+
+    // Samples per pixel; above 1 frames are multisampled and resolved before
+    // they are read back. Clamped to what the implementation supports.
+    void setSamples(i32 n_samples)
+    {
+        RENDERER_ASSERT(n_samples > 0, "Expected at least one sample, got %d.", n_samples);
+        samples = n_samples;
+    }
+
+    void setRenderTargetFormats(ColourFormat colour, DepthFormat depth)
+    {
+        colour_format = colour;
+        depth_format = depth;
+    }
+
+    std::vector<u8> readback_row;
+
+    // Reads the rendered frame back synchronously, as the frame's readback pass.
+    void readFrameRGB(u8 *pixels, bool flip)
+    {
+        beginGpuPass(renderer.gpu_profiler, GpuPass::READBACK);
+        readPixelsRGB(surface_state.client_width, surface_state.client_height, pixels, flip, readback_row);
+        endGpuPass(renderer.gpu_profiler, GpuPass::READBACK);
+    }
+
+    // Starts the rendered frame's readback into the ring; the pass times the copy.
+    void issueFrameReadback()
+    {
+        beginGpuPass(renderer.gpu_profiler, GpuPass::READBACK);
+        issueReadback(renderer.readback_ring, surface_state.client_width, surface_state.client_height);
+        endGpuPass(renderer.gpu_profiler, GpuPass::READBACK);
+    }
+
 #if PYTHON_BINDING
-    void particles(nanobind::ndarray<f32, nanobind::shape<-1, 3>>& centres, nanobind::ndarray<f32, nanobind::shape<-1, 4>>& colours, f32 radius)
+    void particles(nanobind::ndarray<nanobind::ro, nanobind::shape<-1, 3>, nanobind::device::cpu>& centres, nanobind::ndarray<nanobind::ro, nanobind::shape<-1, 4>, nanobind::device::cpu>& colours, f32 radius)
     {
-        RENDERER_ASSERT((centres.ndim() == 2), "Expected array to be dimension %d",2);
-        RENDERER_ASSERT((colours.ndim() == 2), "Expected array to be dimension %d",2);
         setRadius(renderer,radius);
-
-        
-        // RENDERER_LOG("Device ID = %u (cpu=%i, cuda=%i)\n", a.device_id(),int(a.device_type() == nanobind::device::cpu::value),int(a.device_type() == nanobind::device::cuda::value));
-        
-        i64 points_to_allocate = centres.shape(0);
-        for (i64 i = 0; i < points_to_allocate; ++i)
-        {
-            glmath::Vec4 pos = {centres(i, 0), centres(i, 1), centres(i,2), 0.0};
-            glmath::Vec4 colour = {colours(i, 0), colours(i, 1), colours(i, 2), colours(i, 3)};
-            // RENDERER_LOG("%f, %f, %f, %f",colour.x,colour.y, colour.z,colour.a);
-            renderer.particle_data.push_back({pos, colour});
-        }
+        ingestParticles(renderer, ingestSourceFromArray(centres), ingestSourceFromArray(colours));
     }
 
     void setCamera(nanobind::ndarray<f32, nanobind::shape<3>> np_pos, nanobind::ndarray<f32, nanobind::shape<3>> np_lookat)
@@ -171,76 +171,323 @@ struct GlRenderer
         glClearColor(np_colour(0), np_colour(1), np_colour(2),1.0);
     }
 
-    auto getImageRGB()
+    // Renders and reads back an RGB image, top row first. The pixels go into
+    // out when it is given, a C-contiguous uint8 array of shape (height, width, 3)
+    // that can be reused across frames, otherwise into a newly allocated array.
+    // Returns the array written, or None while the readback ring is filling.
+    nanobind::object getImageRGB(nanobind::object out)
     {
-        constexpr f32 vertical_fov = 45.0 * glmath::PI / 180.0;
-        constexpr f32 near_plane = 0.1f;
-        constexpr f32 far_plane  = 1000.f;
-        const f32 aspect_ratio = static_cast<f32>(surface_state.client_width) / static_cast<f32>(surface_state.client_height);
-        glmath::Mat4x4 projection = glmath::perspectiveProjection(vertical_fov,aspect_ratio,near_plane,far_plane);
-        
-        constexpr glmath::Vec3 up = {0.0, 1.0, 0.0};
-        glmath::Mat4x4 view = glmath::lookAt(camera.pos,camera.lookat,up);
+        renderFrame();
+        if(renderer.readback_ring.latency > 0)
+            return advanceReadbacks({.out = std::move(out)});
 
-        sortParticlesByDepth(renderer,camera.pos);
-        renderScene(renderer, view, projection);
-        
-        // eglSwapBuffers(surface_state.connection, surface_state.surface);
-        glFlush();
+        u8 *pixels = imageDestination(out, surface_state.client_width, surface_state.client_height);
+        readFrameRGB(pixels, true);
+        return out;
+    }
+
+    nanobind::object saveImageRGB(std::string path)
+    {
+        renderFrame();
+        if(renderer.readback_ring.latency > 0)
+            return advanceReadbacks({.path = std::move(path)});
+
+        // stb flips on write, so keep GL's row order
+        std::vector<u8> pixels = acquireImageBuffer(image_writer, static_cast<i64>(surface_state.client_width) * surface_state.client_height * 3);
+        readFrameRGB(pixels.data(), false);
+        writeImage(image_writer, std::move(path), std::move(pixels), surface_state.client_width, surface_state.client_height);
+        return nanobind::none();
+    }
+
+    using ImageArray = nanobind::ndarray<u8, nanobind::shape<-1, -1, 3>, nanobind::c_contig, nanobind::device::cpu>;
+
+    // Where an RGB image of the given size is written: the caller's out array,
+    // checked without converting so writes land in it, or when out is None a new
+    // array owned by numpy, which out is set to.
+    u8 *imageDestination(nanobind::object &out, i32 width, i32 height)
+    {
+        if(out.is_none())
+        {
+            u8 *pixels = new u8[static_cast<u64>(width) * height * 3];
+            nanobind::capsule owner(pixels, [](void *p) noexcept { delete[] static_cast<u8*>(p); });
+            out = nanobind::cast(nanobind::ndarray<u8, nanobind::numpy>(pixels, {static_cast<u64>(height), static_cast<u64>(width), 3}, owner));
+            return pixels;
+        }
+        ImageArray image = nanobind::cast<ImageArray>(out, false);
+        RENDERER_ASSERT(image.shape(0) == static_cast<u64>(height) && image.shape(1) == static_cast<u64>(width), "Expected out to have shape (%d, %d, 3).", height, width);
+        return image.data();
+    }
 
+    std::vector<ViewCamera> view_cameras;
 
-        i32 n_channels= 3;
-        std::vector<u8> colour_buffer(surface_state.client_width * surface_state.client_height * n_channels);
-        std::vector<u8> colour_buffer_flipped(surface_state.client_width * surface_state.client_height * n_channels);
-        i32 pitch = surface_state.client_width * n_channels;
+    // Renders the current particles from every camera, given as rows of
+    // (position, lookat), uploading them once, and reads all views back in one
+    // transfer. Returns a (n_views, height, width, 3) uint8 array, written into
+    // out when it is given. The particles are consumed as by getImageRGB.
+    nanobind::object renderViews(nanobind::ndarray<f32, nanobind::shape<-1, 2, 3>, nanobind::device::cpu> cameras, nanobind::object out)
+    {
+        const i32 n_views = static_cast<i32>(cameras.shape(0));
+        view_cameras.resize(n_views);
+        for(i32 v = 0; v < n_views; ++v)
+        {
+            const Camera view_camera = {.pos = {cameras(v, 0, 0), cameras(v, 0, 1), cameras(v, 0, 2)}, .lookat = {cameras(v, 1, 0), cameras(v, 1, 1), cameras(v, 1, 2)}};
+            view_cameras[v] = {viewMatrix(view_camera), view_camera.pos};
+        }
+        ::renderViews(renderer, view_cameras, projection(), surface_state.client_width, surface_state.client_height);
 
-        glReadPixels(0,0,surface_state.client_width, surface_state.client_height, GL_RGB, GL_UNSIGNED_BYTE, colour_buffer.data());
+        u8 *pixels = imageStackDestination(out, n_views, surface_state.client_width, surface_state.client_height);
+        readViewsRGB(renderer.view_targets, pixels, true, readback_row);
+        return out;
+    }
+
+    using ImageStackArray = nanobind::ndarray<u8, nanobind::shape<-1, -1, -1, 3>, nanobind::c_contig, nanobind::device::cpu>;
 
-        for (i32 i = 0; i < surface_state.client_width * surface_state.client_height * n_channels; ++i) {
-            i32 row = i / pitch;
-            i32 col = i % pitch;
-            colour_buffer_flipped[i] = colour_buffer[(surface_state.client_height - 1 - row) * pitch + col];
+    // As imageDestination, for n_images images stacked along a leading axis.
+    u8 *imageStackDestination(nanobind::object &out, i64 n_images, i32 width, i32 height)
+    {
+        if(out.is_none())
+        {
+            u8 *pixels = new u8[static_cast<u64>(n_images) * width * height * 3];
+            nanobind::capsule owner(pixels, [](void *p) noexcept { delete[] static_cast<u8*>(p); });
+            out = nanobind::cast(nanobind::ndarray<u8, nanobind::numpy>(pixels, {static_cast<u64>(n_images), static_cast<u64>(height), static_cast<u64>(width), 3}, owner));
+            return pixels;
         }
-        return nanobind::cast(nanobind::ndarray<u8, nanobind::numpy>(colour_buffer_flipped.data(), {static_cast<u64>(surface_state.client_height), static_cast<u64>(surface_state.client_width), static_cast<u64>(n_channels)}));
+        ImageStackArray images = nanobind::cast<ImageStackArray>(out, false);
+        RENDERER_ASSERT(images.shape(0) == static_cast<u64>(n_images) && images.shape(1) == static_cast<u64>(height) && images.shape(2) == static_cast<u64>(width), "Expected out to have shape (%lld, %d, %d, 3).", n_images, height, width);
+        return images.data();
     }
 
-    auto saveImageRGB(std::string path)
+    // Renders frame f from positions[f], colours[f] (or colours for every frame
+    // when it is 2D) and cameras[f] = (position, lookat), entirely in C++ with
+    // the GIL released. Readbacks go through the PBO ring at the largest
+    // latency, and once a frame is drawn a worker ingests, culls and sorts the
+    // next one while this thread waits for and copies back earlier frames.
+    // Upload and drawing stay on the GL thread, as does the sort when it needs
+    // GL (see sortUsesGl). Returns the frames as a (frames, height, width, 3)
+    // array, written into out when it is given, or with a path streams them
+    // into an npy sequence there and returns None.
+    nanobind::object renderSequence(nanobind::ndarray<nanobind::ro, nanobind::shape<-1, -1, 3>, nanobind::device::cpu> positions, nanobind::ndarray<nanobind::ro, nanobind::device::cpu> colours, nanobind::ndarray<f32, nanobind::shape<-1, 2, 3>, nanobind::device::cpu> cameras, f32 radius, nanobind::object out, std::string path)
     {
-        constexpr f32 vertical_fov = 45.0 * glmath::PI / 180.0;
-        constexpr f32 near_plane = 0.1f;
-        constexpr f32 far_plane  = 1000.f;
-        const f32 aspect_ratio = static_cast<f32>(surface_state.client_width) / static_cast<f32>(surface_state.client_height);
-        glmath::Mat4x4 projection = glmath::perspectiveProjection(vertical_fov,aspect_ratio,near_plane,far_plane);
-        constexpr glmath::Vec3 up = {0.0, 1.0, 0.0};
-        glmath::Mat4x4 view = glmath::lookAt(camera.pos,camera.lookat,up);
+        const i64 n_frames = static_cast<i64>(positions.shape(0));
+        const i32 width = surface_state.client_width;
+        const i32 height = surface_state.client_height;
+        RENDERER_ASSERT(static_cast<i64>(cameras.shape(0)) == n_frames, "Expected one camera per frame (%lld frames, %lld cameras).", n_frames, static_cast<i64>(cameras.shape(0)));
+        RENDERER_ASSERT(colours.ndim() == 2 || static_cast<i64>(colours.shape(0)) == n_frames, "Expected colours for every frame or one set for all of them.");
+        ReadbackRing &ring = renderer.readback_ring;
+        RENDERER_ASSERT(ring.n_pending == 0, "Flush pending readbacks before rendering a sequence.");
+
+        SequenceWriter frames_file{};
+        u8 *pixels = nullptr;
+        if(path.empty())
+        {
+            pixels = imageStackDestination(out, n_frames, width, height);
+        }
+        else
+        {
+            const bool opened = ::openSequence(frames_file, path.c_str(), n_frames, width, height);
+            RENDERER_ASSERT(opened, "Couldn't create a %lld frame sequence at %s.", n_frames, path.c_str());
+        }
+        const IngestSource shared_colours = colours.ndim() == 2 ? ingestSourceFromArray(colours) : IngestSource{};
 
-        sortParticlesByDepth(renderer,camera.pos);
-        renderScene(renderer, view, projection);
-        
-        // eglSwapBuffers(surface_state.connection, surface_state.surface);
-        glFlush();
+        {
+            nanobind::gil_scoped_release release;
+            const i32 previous_latency = ring.latency;
+            ring.latency = MAX_READBACK_LATENCY;
+            const i64 frame_bytes = static_cast<i64>(width) * height * 3;
+            i64 n_collected = 0;
+            auto collectOldest = [&]
+            {
+                u8 *frame = path.empty() ? pixels + n_collected * frame_bytes : nextSequenceFrame(frames_file);
+                collectReadback(ring, frame, true);
+                ++n_collected;
+            };
+            auto frameCamera = [&](i64 f)
+            {
+                return Camera{.pos = {cameras(f, 0, 0), cameras(f, 0, 1), cameras(f, 0, 2)}, .lookat = {cameras(f, 1, 0), cameras(f, 1, 1), cameras(f, 1, 2)}};
+            };
+            const glmath::Mat4x4 frame_projection = projection();
+            const bool sort_on_worker = !sortUsesGl(renderer);
+            // Touches only the renderer's CPU particle state, which the frame
+            // before has finished with once drawFrame returns.
+            auto prepareFrame = [&](i64 f)
+            {
+                const Camera frame_camera = frameCamera(f);
+                setRadius(renderer, radius);
+                ingestParticles(renderer, ingestSourceFromFrame(positions, f), colours.ndim() == 2 ? shared_colours : ingestSourceFromFrame(colours, f));
+                cullParticles(renderer, frame_projection * viewMatrix(frame_camera));
+                if(sort_on_worker)
+                    sortParticlesByDepth(renderer, frame_camera.pos);
+            };
+
+            TaskQueue preparation{1, 1};
+            if(n_frames > 0)
+                preparation.submit([&]{ prepareFrame(0); });
+            for(i64 f = 0; f < n_frames; ++f)
+            {
+                preparation.wait();
+                camera = frameCamera(f);
+                if(!sort_on_worker)
+                    sortParticlesByDepth(renderer, camera.pos);
+                drawFrame();
+                issueFrameReadback();
+                if(f + 1 < n_frames)
+                    preparation.submit([&, f]{ prepareFrame(f + 1); });
+                if(ring.n_pending > ring.latency)
+                    collectOldest();
+            }
+            while(ring.n_pending > 0)
+                collectOldest();
+            ring.latency = previous_latency;
+        }
 
-        i32 n_channels = 3;
-        std::vector<u8> colour_buffer(surface_state.client_width * surface_state.client_height * n_channels);
+        if(!path.empty())
+        {
+            ::closeSequence(frames_file);
+            return nanobind::none();
+        }
+        return out;
+    }
 
-        glReadPixels(0,0,surface_state.client_width, surface_state.client_height, GL_RGB, GL_UNSIGNED_BYTE, colour_buffer.data());
-        stbi_write_png(path.c_str(),surface_state.client_width, surface_state.client_height ,3, colour_buffer.data(), surface_state.client_width * 3);
+    // Where a frame of the readback ring goes: saved to path, written to a
+    // sequence frame, or otherwise returned to the caller in out.
+    struct PendingReadback
+    {
+        std::string path;
+        u8 *sequence_frame = nullptr;
+        nanobind::object out = nanobind::none();
+    };
+    std::deque<PendingReadback> pending_readbacks;
+    ImageWriter image_writer{};
+
+    // Encodes saveImageRGB frames on n_threads background workers, or on the
+    // calling thread with 0. saveImageRGB blocks while max_queued frames are
+    // waiting for a worker.
+    void setSaveThreads(i32 n_threads, i32 max_queued)
+    {
+        setImageWriterThreads(image_writer, n_threads, max_queued);
     }
 
-#else
-    void particles(const std::vector<glmath::Vec3> &centres, const std::vector<glmath::Vec4> &colours, f32 radius)
+    // Format saveImageRGB writes; the path's extension is left to the caller.
+    void setSaveFormat(ImageFormat format)
     {
-        // set the radius for all particles in the frame, should really just be for this call
-        setRadius(renderer,radius);
+        image_writer.format = format;
+    }
 
+    // Returns once every frame handed to the writer is on disk, with the number
+    // of writes that failed. Frames still in the readback ring haven't been
+    // handed over yet; call flushReadbacks first.
+    i32 flushSaves()
+    {
+        return waitForImageWrites(image_writer);
+    }
+
+    // With a latency of n, getImageRGB and saveImageRGB return after issuing
+    // their frame's readback and finish the frame from n calls earlier: it is
+    // saved if it came from saveImageRGB, otherwise returned as the image. Until
+    // the ring fills, and for saved frames, they return None. Call
+    // flushReadbacks before changing the latency or exiting.
+    void setReadbackLatency(i32 frames)
+    {
+        RENDERER_ASSERT(frames >= 0 && frames <= MAX_READBACK_LATENCY, "Readback latency must be between 0 and %d frames.", MAX_READBACK_LATENCY);
+        RENDERER_ASSERT(renderer.readback_ring.n_pending == 0, "Flush pending readbacks before changing the latency.");
+        renderer.readback_ring.latency = frames;
+    }
+
+    nanobind::object advanceReadbacks(PendingReadback pending)
+    {
+        issueFrameReadback();
+        pending_readbacks.push_back(std::move(pending));
+        if(renderer.readback_ring.n_pending <= renderer.readback_ring.latency)
+            return nanobind::none();
+        return completeOldestReadback();
+    }
+
+    // An image frame goes into the out array passed with it, so a caller cycling
+    // latency + 1 arrays through getImageRGB never has one written while it is
+    // still being read.
+    nanobind::object completeOldestReadback()
+    {
+        const ReadbackSlot &slot = oldestReadback(renderer.readback_ring);
+        const i32 width = slot.width;
+        const i32 height = slot.height;
+        PendingReadback pending = std::move(pending_readbacks.front());
+        pending_readbacks.pop_front();
 
-        i64 points_to_allocate = centres.size();
-        for (i64 i = 0; i < points_to_allocate; ++i)
+        if(!pending.path.empty())
         {
-            glmath::Vec4 pos = {centres[i].x, centres[i].y, centres[i].z, 0.0};
-            glmath::Vec4 colour =colours[i];
-            renderer.particle_data.push_back({pos, colour});
+            // stb flips on write, so keep GL's row order
+            std::vector<u8> pixels = acquireImageBuffer(image_writer, static_cast<i64>(width) * height * 3);
+            collectReadback(renderer.readback_ring, pixels.data(), false);
+            writeImage(image_writer, std::move(pending.path), std::move(pixels), width, height);
+            return nanobind::none();
         }
+        if(pending.sequence_frame != nullptr)
+        {
+            collectReadback(renderer.readback_ring, pending.sequence_frame, true);
+            return nanobind::none();
+        }
+
+        u8 *pixels = imageDestination(pending.out, width, height);
+        collectReadback(renderer.readback_ring, pixels, true);
+        return pending.out;
+    }
+
+    SequenceWriter sequence{};
+
+    // Starts writing frames to path, an .npy of shape (n_frames, height, width, 3)
+    // uint8 preallocated and mapped up front. Frames are added by
+    // appendSequenceFrame, through the readback ring when it has a latency.
+    void openSequence(std::string path, i64 n_frames)
+    {
+        const bool opened = ::openSequence(sequence, path.c_str(), n_frames, surface_state.client_width, surface_state.client_height);
+        RENDERER_ASSERT(opened, "Couldn't create a %lld frame sequence at %s.", n_frames, path.c_str());
+    }
+
+    // With a latency, completing the oldest frame of the ring may give back an
+    // earlier getImageRGB image, which is returned; otherwise returns None.
+    nanobind::object appendSequenceFrame()
+    {
+        RENDERER_ASSERT(sequence.mapped == nullptr || (sequence.width == surface_state.client_width && sequence.height == surface_state.client_height), "The sequence was opened at %d x %d, not the current resolution.", sequence.width, sequence.height);
+        renderFrame();
+        u8 *frame = nextSequenceFrame(sequence);
+        if(renderer.readback_ring.latency > 0)
+            return advanceReadbacks({.sequence_frame = frame});
+        readFrameRGB(frame, true);
+        return nanobind::none();
+    }
+
+    // Closes the sequence, shrinking it to the frames appended, and returns how
+    // many that is. Call flushReadbacks first when the ring has a latency.
+    i64 closeSequence()
+    {
+        for(const PendingReadback &pending : pending_readbacks)
+            RENDERER_ASSERT(pending.sequence_frame == nullptr, "Flush pending readbacks before closing the sequence.");
+        return ::closeSequence(sequence);
+    }
+
+    // Finishes every frame still in flight. Returns the getImageRGB images among them, oldest first.
+    nanobind::list flushReadbacks()
+    {
+        nanobind::list images;
+        while(renderer.readback_ring.n_pending > 0)
+        {
+            nanobind::object image = completeOldestReadback();
+            if(!image.is_none())
+                images.append(image);
+        }
+        return images;
+    }
+
+#else
+    void particles(const std::vector<glmath::Vec3> &centres, const std::vector<glmath::Vec4> &colours, f32 radius)
+    {
+        // Only this call's particles take the radius, earlier calls in the frame keep theirs.
+        setRadius(renderer,radius);
+
+        const i64 n_particles = static_cast<i64>(centres.size());
+        IngestSource positions = {centres.data(), n_particles, 3, 1, 3, IngestType::F32};
+        IngestSource colour_source = {colours.data(), static_cast<i64>(colours.size()), 4, 1, 4, IngestType::F32};
+        ingestParticles(renderer, positions, colour_source);
     }
 
     void setCamera(glmath::Vec3 pos, glmath::Vec3 lookat)
@@ -254,23 +501,13 @@ struct GlRenderer
     }
     void show(const std::string &path)
     {
-        constexpr f32 vertical_fov = 45.0 * glmath::PI / 180.0;
-        constexpr f32 near_plane = 0.1f;
-        constexpr f32 far_plane  = 1000.f;
-        const f32 aspect_ratio = static_cast<f32>(surface_state.client_width) / static_cast<f32>(surface_state.client_height);
-        glmath::Mat4x4 projection = glmath::perspectiveProjection(vertical_fov,aspect_ratio,near_plane,far_plane);
-        
-        constexpr glmath::Vec3 up = {0.0, 1.0, 0.0};
-        glmath::Mat4x4 view = glmath::lookAt(camera.pos,camera.lookat,up);
-
-        sortParticlesByDepth(renderer,camera.pos);
-        renderScene(renderer, view, projection);
+        renderFrame();
         // eglSwapBuffers(surface_state.connection, surface_state.surface);
         glFinish();
 
         std::vector<u8> colour_buffer(surface_state.client_width * surface_state.client_height * 3);
 
-        glReadPixels(0,0,surface_state.client_width, surface_state.client_height, GL_RGB, GL_UNSIGNED_BYTE, colour_buffer.data());
+        readFrameRGB(colour_buffer.data(), false);
         stbi_write_png(path.c_str(), surface_state.client_width, surface_state.client_height,3,colour_buffer.data(), surface_state.client_width * 3);
     }
 #endif
@@ -281,16 +518,54 @@ struct GlRenderer
 
 #if PYTHON_BINDING
 NB_MODULE(glrendererEGL, m) {
-    nanobind::class_<GlRenderer>(m, "GlRenderer")
+    // Every PNG the module writes is handed rows bottom-up, GL's order.
+    stbi_flip_vertically_on_write(true);
+
+    bindRendererControls(m);
+
+    nanobind::enum_<ImageFormat>(m, "ImageFormat")
+        .value("PNG", ImageFormat::PNG)
+        .value("QOI", ImageFormat::QOI);
+
+    nanobind::enum_<ColourFormat>(m, "ColourFormat")
+        .value("RGBA8", ColourFormat::RGBA8)
+        .value("RGB10_A2", ColourFormat::RGB10_A2)
+        .value("RGBA16F", ColourFormat::RGBA16F);
+
+    nanobind::enum_<DepthFormat>(m, "DepthFormat")
+        .value("DEPTH16", DepthFormat::DEPTH16)
+        .value("DEPTH24", DepthFormat::DEPTH24)
+        .value("DEPTH32F", DepthFormat::DEPTH32F);
+
+    nanobind::class_<GlRenderer, RendererControls>(m, "GlRenderer")
         .def(nanobind::init<i32, i32>())
-        .def("getImageRGB", &GlRenderer::getImageRGB)
+        .def("getImageRGB", &GlRenderer::getImageRGB, nanobind::arg("out") = nanobind::none())
         .def("particles", &GlRenderer::particles)
         .def("setCamera", &GlRenderer::setCamera)
         .def("setBackgroundColour", &GlRenderer::setBackgroundColour)
-        .def("saveImageRGB", &GlRenderer::saveImageRGB);
+        .def("setResolution", &GlRenderer::setResolution)
+        .def("setSamples", &GlRenderer::setSamples)
+        .def("setRenderTargetFormats", &GlRenderer::setRenderTargetFormats)
+        .def("saveImageRGB", &GlRenderer::saveImageRGB)
+        .def("setReadbackLatency", &GlRenderer::setReadbackLatency)
+        .def("flushReadbacks", &GlRenderer::flushReadbacks)
+        .def("renderViews", &GlRenderer::renderViews, nanobind::arg("cameras"), nanobind::arg("out") = nanobind::none())
+        .def("renderSequence", &GlRenderer::renderSequence, nanobind::arg("positions"), nanobind::arg("colours"), nanobind::arg("cameras"), nanobind::arg("radius"), nanobind::arg("out") = nanobind::none(), nanobind::arg("path") = "")
+        .def("setSaveThreads", &GlRenderer::setSaveThreads, nanobind::arg("n_threads"), nanobind::arg("max_queued") = 4)
+        .def("setSaveFormat", &GlRenderer::setSaveFormat)
+        .def("flushSaves", &GlRenderer::flushSaves)
+        .def("openSequence", &GlRenderer::openSequence)
+        .def("appendSequenceFrame", &GlRenderer::appendSequenceFrame)
+        .def("closeSequence", &GlRenderer::closeSequence);
+
+    // Releases the GIL so a script can convert frames on several threads.
+    m.def("convertQoiToPng", [](const std::string &qoi_path, const std::string &png_path)
+    {
+        return convertQoiToPng(qoi_path.c_str(), png_path.c_str());
+    }, nanobind::arg("qoi_path"), nanobind::arg("png_path"), nanobind::call_guard<nanobind::gil_scoped_release>());
 }
 
-#else
+#elif !defined(RENDERER_NO_MAIN)
 
 int main()
 {
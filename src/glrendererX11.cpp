@@ -19,7 +19,8 @@
 
 #include "defintions.h" 
 #include "glmath.h"
-#include "renderer.cpp"
+#include "renderer.h"
+#include "renderer_controls.h"
 
 
 
@@ -210,11 +211,10 @@ void handleUserInput(XEvent &event, Camera& camera, SurfaceState &window_state)
 
 
 
-struct GlRenderer
+struct GlRenderer : RendererControls
 {
     SurfaceState surface_state;
     Camera camera;
-    Renderer renderer;
     GlRenderer()
     {
         RENDERER_LOG("Current Working Directory: %s", std::filesystem::current_path().c_str());
@@ -224,6 +224,7 @@ struct GlRenderer
 
         i32 gl_load_status = gladLoadGLLoader((GLADloadproc)glXGetProcAddress);
         RENDERER_ASSERT(gl_load_status == 1,"Failed to load GL with GLAD.");
+        loadGlExtensions((GLADloadproc)glXGetProcAddress);
         const u8 *version = glGetString(GL_VERSION);
         const char* version_cstr = reinterpret_cast<const char*>(version);
         RENDERER_LOG(version_cstr);
@@ -277,18 +278,10 @@ struct GlRenderer
 
 
 #if PYTHON_BINDING
-    void particles(nanobind::ndarray<f32, nanobind::shape<-1, 3>>& centres, nanobind::ndarray<f32, nanobind::shape<-1, 4>>& colours)
+    void particles(nanobind::ndarray<nanobind::ro, nanobind::shape<-1, 3>, nanobind::device::cpu>& centres, nanobind::ndarray<nanobind::ro, nanobind::shape<-1, 4>, nanobind::device::cpu>& colours, f32 radius)
     {
-        RENDERER_ASSERT((centres.ndim() == 2), "Expected array to be dimension %d",centres.ndim());
-        // RENDERER_LOG("Device ID = %u (cpu=%i, cuda=%i)\n", a.device_id(),int(a.device_type() == nanobind::device::cpu::value),int(a.device_type() == nanobind::device::cuda::value));
-        
-        i64 points_to_allocate = centres.shape(0);
-        for (i64 i = 0; i < points_to_allocate; ++i)
-        {
-            glmath::Vec4 pos = {centres(i, 0), centres(i, 1), centres(i,2), 0.0};
-            glmath::Vec4 colour = {colours(i, 0), colours(i, 1), colours(i, 2), colours(i, 3)};
-            renderer.particle_data.push_back({pos, colour});
-        }
+        setRadius(renderer, radius);
+        ingestParticles(renderer, ingestSourceFromArray(centres), ingestSourceFromArray(colours));
     }
 
     void setCamera(nanobind::ndarray<f32, nanobind::shape<3>> np_pos, nanobind::ndarray<f32, nanobind::shape<3>> np_lookat)
@@ -309,17 +302,13 @@ struct GlRenderer
 #else
     void particles(const std::vector<glmath::Vec3> &centres, const std::vector<glmath::Vec4> &colours, f32 radius)
     {
-        // set the radius for all particles in the frame, should really just be for this call
+        // Only this call's particles take the radius, earlier calls in the frame keep theirs.
         setRadius(renderer, radius);
 
-
-        i64 points_to_allocate = centres.size();
-        for (i64 i = 0; i < points_to_allocate; ++i)
-        {
-            glmath::Vec4 pos = {centres[i].x, centres[i].y, centres[i].z, 0.0};
-            glmath::Vec4 colour =colours[i];
-            renderer.particle_data.push_back({pos, colour});
-        }
+        const i64 n_particles = static_cast<i64>(centres.size());
+        IngestSource positions = {centres.data(), n_particles, 3, 1, 3, IngestType::F32};
+        IngestSource colour_source = {colours.data(), static_cast<i64>(colours.size()), 4, 1, 4, IngestType::F32};
+        ingestParticles(renderer, positions, colour_source);
     }
 
     void setCamera(glmath::Vec3 pos, glmath::Vec3 lookat)
@@ -348,6 +337,7 @@ struct GlRenderer
 
         static std::vector<f32> depth_scratch_buffer(1000000);
         
+        cullParticles(renderer, projection * camera.view);
         sortParticlesByDepth(renderer,camera.pos);
 
         renderScene(renderer, camera.view, projection);
@@ -359,7 +349,7 @@ struct GlRenderer
         ++count;
 
         if(count % 10 ==0)
-            RENDERER_LOG("Frame Time: %fms",avg_frame_time / static_cast<f64>(count));
+            RENDERER_LOG("Frame Time: %fms, Sort: %fms, Visible: %lld/%lld",avg_frame_time / static_cast<f64>(count), renderer.sort_timings.total_ms, renderer.cull_stats.n_visible, renderer.cull_stats.n_visible + renderer.cull_stats.n_culled);
     }
     void logDiagnostics();
 };
@@ -367,14 +357,16 @@ struct GlRenderer
 
 #if PYTHON_BINDING
 NB_MODULE(glrendererX11, m) {
-    nanobind::class_<GlRenderer>(m, "GlRenderer")
+    bindRendererControls(m);
+
+    nanobind::class_<GlRenderer, RendererControls>(m, "GlRenderer")
         .def(nanobind::init<>())
         .def("show", &GlRenderer::show)
         .def("windowIsClosed", &GlRenderer::windowIsClosed)
         .def("processWindowInput", &GlRenderer::processWindowInput)
         .def("logDiagnostics", &GlRenderer::logDiagnostics)
         // .def("inspect", &GlRenderer::inspect)
-        .def("particles", &GlRenderer::particles)
+        .def("particles", &GlRenderer::particles, nanobind::arg("centres"), nanobind::arg("colours"), nanobind::arg("radius") = 0.005f)
         .def("setCamera", &GlRenderer::setCamera)
         .def("setBackgroundColour", &GlRenderer::setBackgroundColour);
 
@@ -0,0 +1,243 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include "defintions.h"
+#include "external/glad/glad.h"
+#include "glextensions.h"
+#include <array>
+
+#if PYTHON_BINDING
+#include <nanobind/nanobind.h>
+#endif
+
+
+// Passes of a frame timed on the GPU, each at most once per frame.
+enum class GpuPass : u32
+{
+    CLEAR,
+    UPLOAD,
+    DRAW,
+    COMPOSITE, // weighted OIT resolve
+    READBACK,
+    COUNT
+};
+constexpr i32 GPU_PASS_COUNT = static_cast<i32>(GpuPass::COUNT);
+
+// Counted over the particle draw. The last three need pipeline statistics
+// queries (GL 4.6 or ARB_pipeline_statistics_query).
+enum class GpuCounter : u32
+{
+    SAMPLES_PASSED,
+    PRIMITIVES_GENERATED,
+    VERTEX_SHADER_INVOCATIONS,
+    CLIPPING_INPUT_PRIMITIVES,
+    FRAGMENT_SHADER_INVOCATIONS,
+    COUNT
+};
+constexpr i32 GPU_COUNTER_COUNT = static_cast<i32>(GpuCounter::COUNT);
+constexpr i32 GPU_CORE_COUNTER_COUNT = 2;
+constexpr GLenum GPU_COUNTER_TARGETS[GPU_COUNTER_COUNT] = {
+    GL_SAMPLES_PASSED,
+    GL_PRIMITIVES_GENERATED,
+    GL_VERTEX_SHADER_INVOCATIONS,
+    GL_CLIPPING_INPUT_PRIMITIVES,
+    GL_FRAGMENT_SHADER_INVOCATIONS
+};
+
+// Results of the most recent frame whose queries have finished. Passes the
+// frame didn't run take 0 ms; counters that weren't available are -1.
+struct GpuStats
+{
+    std::array<f64, GPU_PASS_COUNT> pass_ms;
+    std::array<i64, GPU_COUNTER_COUNT> counters;
+    f64 total_ms;
+    i64 frame;            // which frame, counting from when profiling started
+    i64 n_frames_skipped; // frames left untimed because every query set was in flight
+};
+
+constexpr i32 GPU_QUERY_FRAMES = 4;
+
+struct GpuQueryFrame
+{
+    std::array<u32, GPU_PASS_COUNT> timers;
+    std::array<u32, GPU_COUNTER_COUNT> counters;
+    std::array<bool, GPU_PASS_COUNT> timed;
+    bool counted;
+    bool pending; // closed and waiting for its results
+    i64 frame;
+};
+
+// Ring of query sets, one per frame. A frame's results are only read once the
+// GPU reports them available, a few frames later, so profiling never waits on
+// the GPU; when every set is still in flight the frame goes untimed.
+struct GpuProfiler
+{
+    std::array<GpuQueryFrame, GPU_QUERY_FRAMES> frames;
+    i32 current = -1; // set of the open frame, -1 when there is none
+    i32 next = 0;     // also the oldest pending set
+    i32 active_pass = -1;
+    i64 n_frames = 0;
+    bool enabled = false;
+    GpuStats stats;
+};
+
+// Creates the queries the first time profiling is enabled.
+inline void setGpuProfiling(GpuProfiler &profiler, bool enabled)
+{
+    if(enabled && profiler.frames[0].timers[0] == 0)
+    {
+        for(GpuQueryFrame &frame : profiler.frames)
+        {
+            glGenQueries(GPU_PASS_COUNT, frame.timers.data());
+            glGenQueries(GPU_COUNTER_COUNT, frame.counters.data());
+        }
+        profiler.stats = {};
+    }
+    profiler.enabled = enabled;
+}
+
+inline i32 gpuCounterCount()
+{
+    return gl_extensions.pipeline_statistics ? GPU_COUNTER_COUNT : GPU_CORE_COUNTER_COUNT;
+}
+
+inline bool gpuQueryFrameAvailable(const GpuQueryFrame &frame)
+{
+    auto available = [](u32 query)
+    {
+        u32 result = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &result);
+        return result != 0;
+    };
+    for(i32 pass = 0; pass < GPU_PASS_COUNT; ++pass)
+        if(frame.timed[pass] && !available(frame.timers[pass]))
+            return false;
+    for(i32 counter = 0; frame.counted && counter < gpuCounterCount(); ++counter)
+        if(!available(frame.counters[counter]))
+            return false;
+    return true;
+}
+
+inline void collectGpuQueryFrame(GpuProfiler &profiler, GpuQueryFrame &frame)
+{
+    GpuStats &stats = profiler.stats;
+    stats.total_ms = 0.0;
+    for(i32 pass = 0; pass < GPU_PASS_COUNT; ++pass)
+    {
+        GLuint64 elapsed_ns = 0;
+        if(frame.timed[pass])
+            glGetQueryObjectui64v(frame.timers[pass], GL_QUERY_RESULT, &elapsed_ns);
+        stats.pass_ms[pass] = static_cast<f64>(elapsed_ns) / 1.0e6;
+        stats.total_ms += stats.pass_ms[pass];
+    }
+    stats.counters.fill(-1);
+    for(i32 counter = 0; frame.counted && counter < gpuCounterCount(); ++counter)
+    {
+        GLuint64 count = 0;
+        glGetQueryObjectui64v(frame.counters[counter], GL_QUERY_RESULT, &count);
+        stats.counters[counter] = static_cast<i64>(count);
+    }
+    stats.frame = frame.frame;
+    frame.pending = false;
+}
+
+// Ends the open frame, if any; passes outside a frame go untimed.
+inline void closeGpuFrame(GpuProfiler &profiler)
+{
+    RENDERER_ASSERT(profiler.active_pass < 0, "Closing a GPU frame inside a pass.");
+    if(profiler.current < 0)
+        return;
+    profiler.frames[profiler.current].pending = true;
+    profiler.current = -1;
+}
+
+// Collects every finished frame, then opens the next one. Frames stay open
+// until the next begins, so readbacks issued after rendering count with them.
+inline void beginGpuFrame(GpuProfiler &profiler)
+{
+    closeGpuFrame(profiler);
+    // Pending sets finish in the order they were issued, oldest at next.
+    for(i32 i = 0; i < GPU_QUERY_FRAMES; ++i)
+    {
+        GpuQueryFrame &frame = profiler.frames[(profiler.next + i) % GPU_QUERY_FRAMES];
+        if(!frame.pending)
+            continue;
+        if(!gpuQueryFrameAvailable(frame))
+            break;
+        collectGpuQueryFrame(profiler, frame);
+    }
+    if(!profiler.enabled)
+        return;
+
+    const i64 frame_index = profiler.n_frames++;
+    GpuQueryFrame &frame = profiler.frames[profiler.next];
+    if(frame.pending)
+    {
+        ++profiler.stats.n_frames_skipped;
+        return;
+    }
+    frame.timed = {};
+    frame.counted = false;
+    frame.frame = frame_index;
+    profiler.current = profiler.next;
+    profiler.next = (profiler.next + 1) % GPU_QUERY_FRAMES;
+}
+
+inline void beginGpuPass(GpuProfiler &profiler, GpuPass pass)
+{
+    if(profiler.current < 0 || profiler.active_pass >= 0)
+        return;
+    GpuQueryFrame &frame = profiler.frames[profiler.current];
+    const i32 index = static_cast<i32>(pass);
+    if(frame.timed[index])
+        return;
+    glBeginQuery(GL_TIME_ELAPSED, frame.timers[index]);
+    if(pass == GpuPass::DRAW)
+    {
+        for(i32 counter = 0; counter < gpuCounterCount(); ++counter)
+            glBeginQuery(GPU_COUNTER_TARGETS[counter], frame.counters[counter]);
+    }
+    profiler.active_pass = index;
+}
+
+inline void endGpuPass(GpuProfiler &profiler, GpuPass pass)
+{
+    const i32 index = static_cast<i32>(pass);
+    if(profiler.active_pass != index)
+        return;
+    GpuQueryFrame &frame = profiler.frames[profiler.current];
+    glEndQuery(GL_TIME_ELAPSED);
+    if(pass == GpuPass::DRAW)
+    {
+        for(i32 counter = 0; counter < gpuCounterCount(); ++counter)
+            glEndQuery(GPU_COUNTER_TARGETS[counter]);
+        frame.counted = true;
+    }
+    frame.timed[index] = true;
+    profiler.active_pass = -1;
+}
+
+#if PYTHON_BINDING
+// Exposes GpuStats as a read-only object with one attribute per pass and counter.
+inline void bindGpuStats(nanobind::module_ &m)
+{
+    auto pass_ms = [](GpuPass pass) { return [pass](const GpuStats &stats) { return stats.pass_ms[static_cast<i32>(pass)]; }; };
+    auto counter = [](GpuCounter counter) { return [counter](const GpuStats &stats) { return stats.counters[static_cast<i32>(counter)]; }; };
+    nanobind::class_<GpuStats>(m, "GpuStats")
+        .def_prop_ro("clear_ms", pass_ms(GpuPass::CLEAR))
+        .def_prop_ro("upload_ms", pass_ms(GpuPass::UPLOAD))
+        .def_prop_ro("draw_ms", pass_ms(GpuPass::DRAW))
+        .def_prop_ro("composite_ms", pass_ms(GpuPass::COMPOSITE))
+        .def_prop_ro("readback_ms", pass_ms(GpuPass::READBACK))
+        .def_ro("total_ms", &GpuStats::total_ms)
+        .def_prop_ro("samples_passed", counter(GpuCounter::SAMPLES_PASSED))
+        .def_prop_ro("primitives_generated", counter(GpuCounter::PRIMITIVES_GENERATED))
+        .def_prop_ro("vertex_shader_invocations", counter(GpuCounter::VERTEX_SHADER_INVOCATIONS))
+        .def_prop_ro("clipping_input_primitives", counter(GpuCounter::CLIPPING_INPUT_PRIMITIVES))
+        .def_prop_ro("fragment_shader_invocations", counter(GpuCounter::FRAGMENT_SHADER_INVOCATIONS))
+        .def_ro("frame", &GpuStats::frame)
+        .def_ro("n_frames_skipped", &GpuStats::n_frames_skipped);
+}
+#endif
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "defintions.h"
+#include "threading.h"
+#include "qoi.h"
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+enum class ImageFormat : u32
+{
+    PNG,
+    QOI // much faster to encode, convert with convertQoiToPng
+};
+
+// Encodes and writes saved frames, either on the calling thread or on a
+// TaskQueue of workers so that PNG compression overlaps with rendering the
+// next frames. Pixel buffers cycle through a free list, so steady-state saves
+// don't allocate once as many buffers exist as frames can be in flight.
+// Include after stb_image_write.h, which the front ends compile in.
+struct ImageWriter
+{
+    std::mutex lock;
+    std::vector<std::vector<u8>> free_buffers;
+    i32 n_failed;
+    ImageFormat format;
+    // Last, so it is destroyed first and its queued writes finish while they
+    // can still reach lock and free_buffers. Null writes synchronously.
+    std::unique_ptr<TaskQueue> queue;
+};
+
+// Waits for the writes in flight and reports how many failed since the last call.
+i32 waitForImageWrites(ImageWriter &writer)
+{
+    if(writer.queue)
+        writer.queue->wait();
+    std::lock_guard<std::mutex> guard(writer.lock);
+    const i32 n_failed = writer.n_failed;
+    writer.n_failed = 0;
+    return n_failed;
+}
+
+// n_threads of 0 goes back to writing on the calling thread. Finishes the
+// writes in flight first.
+void setImageWriterThreads(ImageWriter &writer, i32 n_threads, i32 max_queued)
+{
+    RENDERER_ASSERT(n_threads >= 0 && max_queued > 0, "Expected n_threads >= 0 and max_queued > 0, got %d and %d.", n_threads, max_queued);
+    writer.queue.reset();
+    if(n_threads > 0)
+        writer.queue = std::make_unique<TaskQueue>(n_threads, max_queued);
+}
+
+// A buffer of at least bytes for the next frame, reusing one whose write finished.
+std::vector<u8> acquireImageBuffer(ImageWriter &writer, i64 bytes)
+{
+    std::vector<u8> buffer;
+    {
+        std::lock_guard<std::mutex> guard(writer.lock);
+        if(!writer.free_buffers.empty())
+        {
+            buffer = std::move(writer.free_buffers.back());
+            writer.free_buffers.pop_back();
+        }
+    }
+    buffer.resize(bytes);
+    return buffer;
+}
+
+bool writeFile(const char *path, const u8 *data, i64 size)
+{
+    FILE *file = fopen(path, "wb");
+    if(file == nullptr)
+        return false;
+    const bool written = fwrite(data, 1, size, file) == static_cast<u64>(size);
+    return fclose(file) == 0 && written;
+}
+
+bool encodeImage(ImageFormat format, const char *path, const u8 *pixels, i32 width, i32 height)
+{
+    if(format == ImageFormat::QOI)
+    {
+        thread_local std::vector<u8> encoded;
+        qoiEncodeRGB(pixels, width, height, true, encoded);
+        return writeFile(path, encoded.data(), static_cast<i64>(encoded.size()));
+    }
+    // stbi_flip_vertically_on_write is set once up front, so workers only read it
+    return stbi_write_png(path, width, height, 3, pixels, width * 3) != 0;
+}
+
+// Writes tightly packed RGB pixels, rows in GL's bottom-up order, in the
+// writer's current format. Blocks while the queue is full; the buffer returns
+// to the free list after.
+void writeImage(ImageWriter &writer, std::string path, std::vector<u8> pixels, i32 width, i32 height)
+{
+    auto encode = [&writer, format = writer.format, path = std::move(path), pixels = std::move(pixels), width, height]() mutable
+    {
+        const bool written = encodeImage(format, path.c_str(), pixels.data(), width, height);
+        if(!written)
+            RENDERER_LOG("Failed to write %s.", path.c_str());
+        std::lock_guard<std::mutex> guard(writer.lock);
+        writer.n_failed += written ? 0 : 1;
+        writer.free_buffers.push_back(std::move(pixels));
+    };
+    if(writer.queue)
+        writer.queue->submit(std::move(encode));
+    else
+        encode();
+}
+
+// Rewrites a QOI file written by the QOI format as a standard PNG.
+bool convertQoiToPng(const char *qoi_path, const char *png_path)
+{
+    FILE *file = fopen(qoi_path, "rb");
+    if(file == nullptr)
+        return false;
+    std::vector<u8> data;
+    u8 chunk[1 << 16];
+    u64 n_read;
+    while((n_read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        data.insert(data.end(), chunk, chunk + n_read);
+    fclose(file);
+
+    std::vector<u8> pixels;
+    i32 width, height;
+    if(!qoiDecodeRGB(data.data(), static_cast<i64>(data.size()), true, pixels, width, height))
+        return false;
+    return encodeImage(ImageFormat::PNG, png_path, pixels.data(), width, height);
+}
+
+#endif
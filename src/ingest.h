@@ -0,0 +1,246 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include "defintions.h"
+#include <cstring>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if PYTHON_BINDING
+#include <nanobind/ndarray.h>
+#endif
+
+
+enum class IngestType : u32
+{
+    F32,
+    F64
+};
+
+// An (n, components) array described by element strides, as handed over by numpy.
+struct IngestSource
+{
+    const void *data;
+    i64 rows;
+    i64 row_stride;
+    i64 column_stride;
+    i32 components;
+    IngestType type;
+};
+
+
+template <typename T>
+inline void ingestRows4Scalar(f32 *dst, i64 dst_stride, const IngestSource &src, i64 begin, i64 end, f32 w)
+{
+    const T *data = static_cast<const T*>(src.data);
+    for(i64 i = begin; i < end; ++i)
+    {
+        const T *row = data + i * src.row_stride;
+        f32 *out = dst + i * dst_stride;
+        out[0] = static_cast<f32>(row[0]);
+        out[1] = static_cast<f32>(row[src.column_stride]);
+        out[2] = static_cast<f32>(row[2 * src.column_stride]);
+        out[3] = src.components == 4 ? static_cast<f32>(row[3 * src.column_stride]) : w;
+    }
+}
+
+#if defined(__SSE2__)
+// Tightly packed xyz f32 rows, four at a time: three loads cover four rows and
+// shuffles spread them into vec4s padded with the given w.
+inline i64 ingestPackedVec3F32(f32 *dst, i64 dst_stride, const f32 *src, i64 begin, i64 end, f32 w)
+{
+    const __m128 xyz_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    const __m128 w_lane = _mm_set_ps(w, 0.0f, 0.0f, 0.0f);
+    i64 i = begin;
+    for(; i + 4 <= end; i += 4)
+    {
+        const f32 *rows = src + i * 3;
+        __m128 a = _mm_loadu_ps(rows);     // x0 y0 z0 x1
+        __m128 b = _mm_loadu_ps(rows + 4); // y1 z1 x2 y2
+        __m128 c = _mm_loadu_ps(rows + 8); // z2 x3 y3 z3
+
+        __m128 p0 = a;
+        __m128 t = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 3, 3));
+        __m128 p1 = _mm_shuffle_ps(t, t, _MM_SHUFFLE(3, 3, 2, 0));
+        __m128 p2 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(0, 0, 3, 2));
+        __m128 p3 = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 2, 1));
+
+        f32 *out = dst + i * dst_stride;
+        _mm_storeu_ps(out, _mm_or_ps(_mm_and_ps(p0, xyz_mask), w_lane));
+        _mm_storeu_ps(out + dst_stride, _mm_or_ps(_mm_and_ps(p1, xyz_mask), w_lane));
+        _mm_storeu_ps(out + 2 * dst_stride, _mm_or_ps(_mm_and_ps(p2, xyz_mask), w_lane));
+        _mm_storeu_ps(out + 3 * dst_stride, _mm_or_ps(_mm_and_ps(p3, xyz_mask), w_lane));
+    }
+    return i;
+}
+
+// Rows of four f32 with unit column stride, any row stride.
+inline i64 ingestVec4F32(f32 *dst, i64 dst_stride, const f32 *src, i64 row_stride, i64 begin, i64 end)
+{
+    for(i64 i = begin; i < end; ++i)
+        _mm_storeu_ps(dst + i * dst_stride, _mm_loadu_ps(src + i * row_stride));
+    return end;
+}
+
+// Rows of three or four f64 with unit column stride, narrowed two lanes at a time.
+inline i64 ingestRowsF64(f32 *dst, i64 dst_stride, const f64 *src, i64 row_stride, i32 components, i64 begin, i64 end, f32 w)
+{
+    for(i64 i = begin; i < end; ++i)
+    {
+        const f64 *row = src + i * row_stride;
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(row));
+        __m128 hi = components == 4 ? _mm_cvtpd_ps(_mm_loadu_pd(row + 2)) : _mm_cvtpd_ps(_mm_setr_pd(row[2], w));
+        _mm_storeu_ps(dst + i * dst_stride, _mm_movelh_ps(lo, hi));
+    }
+    return end;
+}
+#endif
+
+// Writes rows [begin, end) of src as vec4s at dst + i * dst_stride. Positions
+// (3 components) get the given w. Contiguous columns take the SIMD kernels,
+// anything else falls back to a strided scalar gather.
+inline void ingestRows4(f32 *dst, i64 dst_stride, const IngestSource &src, i64 begin, i64 end, f32 w = 0.0f)
+{
+    RENDERER_ASSERT(src.components == 3 || src.components == 4, "Expected 3 or 4 components, got %d.", src.components);
+#if defined(__SSE2__)
+    if(src.column_stride == 1)
+    {
+        if(src.type == IngestType::F32)
+        {
+            const f32 *data = static_cast<const f32*>(src.data);
+            if(src.components == 4)
+                begin = ingestVec4F32(dst, dst_stride, data, src.row_stride, begin, end);
+            else if(src.row_stride == 3)
+                begin = ingestPackedVec3F32(dst, dst_stride, data, begin, end, w);
+        }
+        else
+        {
+            begin = ingestRowsF64(dst, dst_stride, static_cast<const f64*>(src.data), src.row_stride, src.components, begin, end, w);
+        }
+    }
+#endif
+    if(src.type == IngestType::F32)
+        ingestRows4Scalar<f32>(dst, dst_stride, src, begin, end, w);
+    else
+        ingestRows4Scalar<f64>(dst, dst_stride, src, begin, end, w);
+}
+
+
+// Writes rows [begin, end) of a 3 component src as tightly packed xyz f32 triples.
+inline void ingestRows3(f32 *dst, const IngestSource &src, i64 begin, i64 end)
+{
+    if(src.type == IngestType::F32 && src.row_stride == 3 && src.column_stride == 1)
+    {
+        memcpy(dst + begin * 3, static_cast<const f32*>(src.data) + begin * 3, (end - begin) * 3 * sizeof(f32));
+        return;
+    }
+    for(i64 i = begin; i < end; ++i)
+    {
+        for(i64 j = 0; j < 3; ++j)
+        {
+            i64 element = i * src.row_stride + j * src.column_stride;
+            dst[i * 3 + j] = src.type == IngestType::F32 ? static_cast<const f32*>(src.data)[element] : static_cast<f32>(static_cast<const f64*>(src.data)[element]);
+        }
+    }
+}
+
+// Packs rows [begin, end) of a 4 component src into RGBA8, red in the low byte
+// to match unpackUnorm4x8. Values are clamped to [0, 1] and rounded.
+inline void packRowsRGBA8(u32 *dst, const IngestSource &src, i64 begin, i64 end)
+{
+    RENDERER_ASSERT(src.components == 4, "Expected 4 colour components, got %d.", src.components);
+#if defined(__SSE2__)
+    if(src.column_stride == 1)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        for(; begin < end; ++begin)
+        {
+            __m128 colour;
+            if(src.type == IngestType::F32)
+            {
+                colour = _mm_loadu_ps(static_cast<const f32*>(src.data) + begin * src.row_stride);
+            }
+            else
+            {
+                const f64 *row = static_cast<const f64*>(src.data) + begin * src.row_stride;
+                colour = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(row)), _mm_cvtpd_ps(_mm_loadu_pd(row + 2)));
+            }
+            colour = _mm_min_ps(_mm_max_ps(colour, zero), one);
+            __m128i channels = _mm_cvtps_epi32(_mm_mul_ps(colour, scale));
+            channels = _mm_packs_epi32(channels, channels);
+            channels = _mm_packus_epi16(channels, channels);
+            dst[begin] = static_cast<u32>(_mm_cvtsi128_si32(channels));
+        }
+        return;
+    }
+#endif
+    for(i64 i = begin; i < end; ++i)
+    {
+        u32 packed = 0;
+        for(i64 j = 0; j < 4; ++j)
+        {
+            i64 element = i * src.row_stride + j * src.column_stride;
+            f32 value = src.type == IngestType::F32 ? static_cast<const f32*>(src.data)[element] : static_cast<f32>(static_cast<const f64*>(src.data)[element]);
+            value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+            packed |= static_cast<u32>(lrintf(value * 255.0f)) << (8 * j);
+        }
+        dst[i] = packed;
+    }
+}
+
+
+#if PYTHON_BINDING
+template <typename... Args>
+IngestSource ingestSourceFromArray(const nanobind::ndarray<Args...> &array)
+{
+    RENDERER_ASSERT(array.ndim() == 2, "Expected array to be dimension %d", 2);
+    IngestSource source;
+    source.data = array.data();
+    source.rows = static_cast<i64>(array.shape(0));
+    source.row_stride = array.stride(0);
+    source.column_stride = array.stride(1);
+    source.components = static_cast<i32>(array.shape(1));
+    if(array.dtype() == nanobind::dtype<f32>())
+        source.type = IngestType::F32;
+    else if(array.dtype() == nanobind::dtype<f64>())
+        source.type = IngestType::F64;
+    else
+        RENDERER_ASSERT(false, "Expected a float32 or float64 array.");
+    return source;
+}
+
+// Frame index of an (frames, n, components) array as an (n, components) source.
+template <typename... Args>
+IngestSource ingestSourceFromFrame(const nanobind::ndarray<Args...> &array, i64 frame)
+{
+    RENDERER_ASSERT(array.ndim() == 3, "Expected array to be dimension %d", 3);
+    RENDERER_ASSERT(frame >= 0 && frame < static_cast<i64>(array.shape(0)), "Frame %lld is out of range.", frame);
+    IngestSource source;
+    source.rows = static_cast<i64>(array.shape(1));
+    source.row_stride = array.stride(1);
+    source.column_stride = array.stride(2);
+    source.components = static_cast<i32>(array.shape(2));
+    if(array.dtype() == nanobind::dtype<f32>())
+    {
+        source.type = IngestType::F32;
+        source.data = static_cast<const f32*>(array.data()) + frame * array.stride(0);
+    }
+    else if(array.dtype() == nanobind::dtype<f64>())
+    {
+        source.type = IngestType::F64;
+        source.data = static_cast<const f64*>(array.data()) + frame * array.stride(0);
+    }
+    else
+    {
+        RENDERER_ASSERT(false, "Expected a float32 or float64 array.");
+    }
+    return source;
+}
+#endif
+
+#endif
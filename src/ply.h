@@ -0,0 +1,106 @@
+#ifndef PLY_H
+#define PLY_H
+
+#include "defintions.h"
+#include "glmath.h"
+#include "arena.h"
+#include "utility.h"
+#include <string_view>
+
+
+struct VertexPosNormal
+{
+    glmath::Vec3 pos;
+    glmath::Vec3 normal;
+};
+
+
+
+struct ModelVertexData
+{
+    i32 vertex_offset;
+    i32 index_offset;
+    u32 n_verts;
+    u32 n_indices;
+};
+
+struct ModelMetaData
+{
+    std::string_view blob;
+    u32 nVerts;
+    u32 nTriangles;
+    u32 modelDataOffset;
+};
+
+void getPlyMetaData(ModelMetaData &metaData)
+{
+    constexpr char vertexNumberPreface[] = "vertex ";
+    constexpr u8 vertexNumberPrefaceLength = 7;
+    constexpr char faceNumberPreface[] = "face ";
+    constexpr u8 faceNumberPrefaceLength = 5;
+    constexpr char modelDataPreface[] = "end_header\n";
+    constexpr u8 modelDataPrefaceLength = 11;
+
+    u32 vertexNumberOffset =static_cast<u32>(metaData.blob.find(vertexNumberPreface) + vertexNumberPrefaceLength);
+
+    u32 vertexNumberEnd = vertexNumberOffset;
+    while(metaData.blob[vertexNumberEnd] != '\n') ++vertexNumberEnd;
+
+    u32 faceNumberOffset = static_cast<u32>(metaData.blob.find(faceNumberPreface) + faceNumberPrefaceLength);
+    u32 faceNumberEnd = faceNumberOffset;
+    while(metaData.blob[faceNumberEnd] != '\n') ++faceNumberEnd;
+
+    metaData.nVerts = stringToU32(&metaData.blob[vertexNumberOffset],vertexNumberEnd - vertexNumberOffset);
+    metaData.nTriangles = stringToU32(&metaData.blob[faceNumberOffset], faceNumberEnd - faceNumberOffset);
+    metaData.modelDataOffset = static_cast<u32>(metaData.blob.find(modelDataPreface) + modelDataPrefaceLength);
+}
+
+
+void loadIndices(SubArena &indexDataArena, const ModelMetaData& modelInfo, i64 offset)
+{
+    i32* indices = indexDataArena.arenaPush<i32>(modelInfo.nTriangles * 3);
+    // Assume that all faces are triangles
+    for(u32 i = 0; i < modelInfo.nTriangles; ++i)
+    {
+        // replace reinterpret_cast with memcpy
+        u8 face_number = *reinterpret_cast<const u8*>(&modelInfo.blob[offset]); 
+        offset += 1; // skip number of vertices in the face
+        RENDERER_ASSERT(face_number == 3, "Mesh is not all triangles.");
+
+        indices[i * 3] = *reinterpret_cast<const u32*>(&modelInfo.blob[offset]);
+        offset += 4;
+        indices[i * 3 + 1] = *reinterpret_cast<const u32*>(&modelInfo.blob[offset]);
+        offset += 4;
+        indices[i * 3 + 2] = *reinterpret_cast<const u32*>(&modelInfo.blob[offset]);
+        offset += 4;
+    }
+}
+
+void loadPlyModelPos(SubArena& vertexDataArena, SubArena& indexDataArena,ModelMetaData modelInfo)
+{
+    i64 offset = modelInfo.modelDataOffset;
+    VertexPosNormal* vertices_pos_normal = vertexDataArena.arenaPush<VertexPosNormal>(modelInfo.nVerts);
+    for(u32 i = 0; i < modelInfo.nVerts; ++i)
+    {
+        f32 x = *reinterpret_cast<const f32*>(&modelInfo.blob[offset]);
+        offset += 4;
+        f32 y = *reinterpret_cast<const f32*>(&modelInfo.blob[offset]);
+        offset += 4;
+        f32 z = *reinterpret_cast<const f32*>(&modelInfo.blob[offset]);
+        offset += 4;
+
+        f32 nx = *reinterpret_cast<const f32*>(&modelInfo.blob[offset]);
+        offset += 4;
+        f32 ny = *reinterpret_cast<const f32*>(&modelInfo.blob[offset]);
+        offset += 4;
+        f32 nz = *reinterpret_cast<const f32*>(&modelInfo.blob[offset]);
+        offset += 4;
+        vertices_pos_normal[i] = {
+                        glmath::Vec3(x,y,z),
+                        glmath::Vec3(nx,ny,nz)
+                    };
+    }
+    loadIndices(indexDataArena,modelInfo,offset);
+}
+
+#endif
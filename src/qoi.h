@@ -0,0 +1,214 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include "defintions.h"
+#include <cstring>
+#include <vector>
+
+
+// The "Quite OK Image" format: a lossless single pass codec that turns each
+// pixel into a run, an index into recently seen colours, a small difference
+// from the previous pixel or a literal. It encodes many times faster than
+// deflate for a somewhat larger file. RGB only here; files are top row first.
+constexpr i64 QOI_HEADER_SIZE = 14;
+constexpr u8 QOI_END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+constexpr u8 QOI_OP_INDEX = 0x00;
+constexpr u8 QOI_OP_DIFF  = 0x40;
+constexpr u8 QOI_OP_LUMA  = 0x80;
+constexpr u8 QOI_OP_RUN   = 0xC0;
+constexpr u8 QOI_OP_RGB   = 0xFE;
+constexpr u8 QOI_OP_RGBA  = 0xFF;
+constexpr u8 QOI_OP_MASK  = 0xC0;
+constexpr i32 QOI_MAX_RUN = 62;
+
+struct QoiPixel
+{
+    u8 r, g, b, a;
+    bool operator==(const QoiPixel &other) const = default;
+};
+
+inline u32 qoiHash(QoiPixel p)
+{
+    return (p.r * 3u + p.g * 5u + p.b * 7u + p.a * 11u) % 64u;
+}
+
+inline void qoiWriteU32(u8 *dst, u32 value)
+{
+    dst[0] = static_cast<u8>(value >> 24);
+    dst[1] = static_cast<u8>(value >> 16);
+    dst[2] = static_cast<u8>(value >> 8);
+    dst[3] = static_cast<u8>(value);
+}
+
+inline u32 qoiReadU32(const u8 *src)
+{
+    return (static_cast<u32>(src[0]) << 24) | (static_cast<u32>(src[1]) << 16) | (static_cast<u32>(src[2]) << 8) | src[3];
+}
+
+
+// Encodes tightly packed RGB rows into encoded, replacing its contents.
+// flip_rows reads the rows bottom-up, so GL readbacks come out top row first.
+void qoiEncodeRGB(const u8 *pixels, i32 width, i32 height, bool flip_rows, std::vector<u8> &encoded)
+{
+    const i64 row_bytes = static_cast<i64>(width) * 3;
+    // Worst case every pixel is a 4 byte literal.
+    encoded.resize(QOI_HEADER_SIZE + static_cast<i64>(width) * height * 4 + sizeof(QOI_END_MARKER));
+    u8 *out = encoded.data();
+
+    memcpy(out, "qoif", 4);
+    qoiWriteU32(out + 4, static_cast<u32>(width));
+    qoiWriteU32(out + 8, static_cast<u32>(height));
+    out[12] = 3; // channels
+    out[13] = 0; // sRGB
+    out += QOI_HEADER_SIZE;
+
+    QoiPixel index[64] = {};
+    QoiPixel previous = {0, 0, 0, 255};
+    i32 run = 0;
+    for(i32 y = 0; y < height; ++y)
+    {
+        const u8 *row = pixels + (flip_rows ? height - 1 - y : y) * row_bytes;
+        for(i32 x = 0; x < width; ++x)
+        {
+            const QoiPixel pixel = {row[x * 3], row[x * 3 + 1], row[x * 3 + 2], 255};
+            if(pixel == previous)
+            {
+                if(++run == QOI_MAX_RUN)
+                {
+                    *out++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if(run > 0)
+            {
+                *out++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            const u32 hash = qoiHash(pixel);
+            if(index[hash] == pixel)
+            {
+                *out++ = QOI_OP_INDEX | hash;
+            }
+            else
+            {
+                index[hash] = pixel;
+                // Differences wrap like the decoder's u8 arithmetic.
+                const i32 dr = static_cast<i8>(pixel.r - previous.r);
+                const i32 dg = static_cast<i8>(pixel.g - previous.g);
+                const i32 db = static_cast<i8>(pixel.b - previous.b);
+                const i32 dr_dg = dr - dg;
+                const i32 db_dg = db - dg;
+                if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                {
+                    *out++ = QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+                }
+                else if(dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+                {
+                    *out++ = QOI_OP_LUMA | (dg + 32);
+                    *out++ = static_cast<u8>(((dr_dg + 8) << 4) | (db_dg + 8));
+                }
+                else
+                {
+                    *out++ = QOI_OP_RGB;
+                    *out++ = pixel.r;
+                    *out++ = pixel.g;
+                    *out++ = pixel.b;
+                }
+            }
+            previous = pixel;
+        }
+    }
+    if(run > 0)
+        *out++ = QOI_OP_RUN | (run - 1);
+
+    memcpy(out, QOI_END_MARKER, sizeof(QOI_END_MARKER));
+    out += sizeof(QOI_END_MARKER);
+    encoded.resize(out - encoded.data());
+}
+
+// Decodes a QOI file into tightly packed RGB rows, dropping alpha. flip_rows
+// writes them bottom-up, the order the PNG writer expects. Returns false if
+// the data is not a well formed QOI image.
+bool qoiDecodeRGB(const u8 *data, i64 size, bool flip_rows, std::vector<u8> &pixels, i32 &width, i32 &height)
+{
+    if(size < QOI_HEADER_SIZE + static_cast<i64>(sizeof(QOI_END_MARKER)) || memcmp(data, "qoif", 4) != 0)
+        return false;
+    const u32 header_width = qoiReadU32(data + 4);
+    const u32 header_height = qoiReadU32(data + 8);
+    if(header_width == 0 || header_height == 0 || header_width > 1u << 16 || header_height > 1u << 16)
+        return false;
+    width = static_cast<i32>(header_width);
+    height = static_cast<i32>(header_height);
+
+    const i64 row_bytes = static_cast<i64>(width) * 3;
+    pixels.resize(row_bytes * height);
+    const u8 *in = data + QOI_HEADER_SIZE;
+    const u8 *end = data + size - sizeof(QOI_END_MARKER);
+
+    QoiPixel index[64] = {};
+    QoiPixel pixel = {0, 0, 0, 255};
+    i32 run = 0;
+    for(i32 y = 0; y < height; ++y)
+    {
+        u8 *row = pixels.data() + (flip_rows ? height - 1 - y : y) * row_bytes;
+        for(i32 x = 0; x < width; ++x)
+        {
+            if(run > 0)
+            {
+                --run;
+            }
+            else
+            {
+                if(in >= end)
+                    return false;
+                const u8 op = *in++;
+                if(op == QOI_OP_RGB || op == QOI_OP_RGBA)
+                {
+                    const i64 n_channels = op == QOI_OP_RGB ? 3 : 4;
+                    if(end - in < n_channels)
+                        return false;
+                    pixel.r = in[0];
+                    pixel.g = in[1];
+                    pixel.b = in[2];
+                    if(n_channels == 4)
+                        pixel.a = in[3];
+                    in += n_channels;
+                }
+                else if((op & QOI_OP_MASK) == QOI_OP_INDEX)
+                {
+                    pixel = index[op];
+                }
+                else if((op & QOI_OP_MASK) == QOI_OP_DIFF)
+                {
+                    pixel.r += ((op >> 4) & 3) - 2;
+                    pixel.g += ((op >> 2) & 3) - 2;
+                    pixel.b += (op & 3) - 2;
+                }
+                else if((op & QOI_OP_MASK) == QOI_OP_LUMA)
+                {
+                    if(in >= end)
+                        return false;
+                    const u8 next = *in++;
+                    const i32 dg = (op & 0x3F) - 32;
+                    pixel.r += dg - 8 + ((next >> 4) & 0xF);
+                    pixel.g += dg;
+                    pixel.b += dg - 8 + (next & 0xF);
+                }
+                else
+                {
+                    run = op & 0x3F;
+                }
+                index[qoiHash(pixel)] = pixel;
+            }
+            row[x * 3] = pixel.r;
+            row[x * 3 + 1] = pixel.g;
+            row[x * 3 + 2] = pixel.b;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include "defintions.h"
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+// Particles are quantized in chunks of this many consecutive particles, each
+// with its own bounds. Must match QUANTIZED_CHUNK_SIZE in vertexShader.glsl.
+constexpr i64 QUANTIZED_CHUNK_SIZE = 256;
+constexpr f32 QUANTIZED_MAX_CODE = 65535.0f;
+
+// Decoded position = min + code * step. A chunk too spread out for its codes to
+// meet the tolerance keeps float positions instead, in slot float_chunk of a
+// stream holding QUANTIZED_CHUNK_SIZE xyz triples per slot. Two vec4s for std430.
+struct QuantizedChunk
+{
+    f32 min[3];
+    u32 float_chunk;
+    f32 step[4];
+};
+
+// float_chunk of a chunk decoded from its codes. Must match vertexShader.glsl.
+constexpr u32 QUANTIZED_CODES = 0xFFFFFFFF;
+
+
+// Bounds of xyz triples [begin, end) of a tightly packed position stream.
+inline void positionBounds(const f32 *positions, i64 begin, i64 end, f32 *min, f32 *max)
+{
+    for(i32 axis = 0; axis < 3; ++axis)
+    {
+        min[axis] = INFINITY;
+        max[axis] = -INFINITY;
+    }
+    i64 i = begin;
+#if defined(__SSE2__)
+    // Four particles are three vectors whose lanes cycle through xyzx, yzxy, zxyz.
+    if(end - begin >= 4)
+    {
+        __m128 min0 = _mm_set1_ps(INFINITY), min1 = min0, min2 = min0;
+        __m128 max0 = _mm_set1_ps(-INFINITY), max1 = max0, max2 = max0;
+        for(; i + 4 <= end; i += 4)
+        {
+            const f32 *p = positions + i * 3;
+            __m128 a = _mm_loadu_ps(p);
+            __m128 b = _mm_loadu_ps(p + 4);
+            __m128 c = _mm_loadu_ps(p + 8);
+            min0 = _mm_min_ps(min0, a); max0 = _mm_max_ps(max0, a);
+            min1 = _mm_min_ps(min1, b); max1 = _mm_max_ps(max1, b);
+            min2 = _mm_min_ps(min2, c); max2 = _mm_max_ps(max2, c);
+        }
+        alignas(16) f32 lanes_min[12];
+        alignas(16) f32 lanes_max[12];
+        _mm_store_ps(lanes_min, min0); _mm_store_ps(lanes_min + 4, min1); _mm_store_ps(lanes_min + 8, min2);
+        _mm_store_ps(lanes_max, max0); _mm_store_ps(lanes_max + 4, max1); _mm_store_ps(lanes_max + 8, max2);
+        for(i32 lane = 0; lane < 12; ++lane)
+        {
+            min[lane % 3] = std::min(min[lane % 3], lanes_min[lane]);
+            max[lane % 3] = std::max(max[lane % 3], lanes_max[lane]);
+        }
+    }
+#endif
+    for(; i < end; ++i)
+    {
+        for(i32 axis = 0; axis < 3; ++axis)
+        {
+            min[axis] = std::min(min[axis], positions[i * 3 + axis]);
+            max[axis] = std::max(max[axis], positions[i * 3 + axis]);
+        }
+    }
+}
+
+// Chooses the chunk's decode parameters and returns the largest position error
+// the 16-bit codes can introduce (half a step along each axis).
+inline f32 quantizedChunkBounds(const f32 *min, const f32 *max, QuantizedChunk &chunk)
+{
+    f32 error_squared = 0.0f;
+    for(i32 axis = 0; axis < 3; ++axis)
+    {
+        chunk.min[axis] = min[axis];
+        chunk.step[axis] = (max[axis] - min[axis]) / QUANTIZED_MAX_CODE;
+        error_squared += 0.25f * chunk.step[axis] * chunk.step[axis];
+    }
+    chunk.step[3] = 0.0f;
+    return sqrtf(error_squared);
+}
+
+// Spreads the low 10 bits of v out to every third bit.
+inline u32 spreadBits10(u32 v)
+{
+    v &= 0x3FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// 30-bit Morton code of an xyz position on a 1024^3 grid, where scale maps the
+// bounds from min onto [0, 1024). Particles in key order fill consecutive
+// chunks from small regions of space.
+inline u32 mortonKey(const f32 *position, const f32 *min, const f32 *scale)
+{
+    u32 key = 0;
+    for(i32 axis = 0; axis < 3; ++axis)
+    {
+        const f32 cell = std::min(std::max((position[axis] - min[axis]) * scale[axis], 0.0f), 1023.0f);
+        key |= spreadBits10(static_cast<u32>(cell)) << axis;
+    }
+    return key;
+}
+
+// Encodes xyz triples [begin, end) relative to the chunk as u16 codes, written
+// tightly packed (three per particle) to codes + begin * 3.
+inline void quantizePositions(const f32 *positions, const QuantizedChunk &chunk, i64 begin, i64 end, u16 *codes)
+{
+    f32 scale[3];
+    for(i32 axis = 0; axis < 3; ++axis)
+        scale[axis] = chunk.step[axis] > 0.0f ? 1.0f / chunk.step[axis] : 0.0f;
+
+    i64 element = begin * 3;
+    const i64 end_element = end * 3;
+#if defined(__SSE2__)
+    // Eight values per iteration; the xyz pattern repeats every 24 values, so
+    // the bounds cycle through three lane arrangements.
+    __m128 lane_min[3];
+    __m128 lane_scale[3];
+    for(i32 phase = 0; phase < 3; ++phase)
+    {
+        lane_min[phase] = _mm_setr_ps(chunk.min[(phase * 4) % 3], chunk.min[(phase * 4 + 1) % 3], chunk.min[(phase * 4 + 2) % 3], chunk.min[(phase * 4 + 3) % 3]);
+        lane_scale[phase] = _mm_setr_ps(scale[(phase * 4) % 3], scale[(phase * 4 + 1) % 3], scale[(phase * 4 + 2) % 3], scale[(phase * 4 + 3) % 3]);
+    }
+    const __m128 max_code = _mm_set1_ps(QUANTIZED_MAX_CODE);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128i sign_flip = _mm_set1_epi32(32768);
+    const __m128i sign_flip16 = _mm_set1_epi16(static_cast<i16>(0x8000));
+    i32 phase = 0;
+    for(; element + 8 <= end_element; element += 8)
+    {
+        __m128 lo = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(positions + element), lane_min[phase]), lane_scale[phase]);
+        phase = phase == 2 ? 0 : phase + 1;
+        __m128 hi = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(positions + element + 4), lane_min[phase]), lane_scale[phase]);
+        phase = phase == 2 ? 0 : phase + 1;
+        lo = _mm_min_ps(_mm_max_ps(lo, zero), max_code);
+        hi = _mm_min_ps(_mm_max_ps(hi, zero), max_code);
+        // SSE2 only packs signed, so shift into i16 range and flip the sign bit back.
+        __m128i lo_codes = _mm_sub_epi32(_mm_cvtps_epi32(lo), sign_flip);
+        __m128i hi_codes = _mm_sub_epi32(_mm_cvtps_epi32(hi), sign_flip);
+        __m128i packed = _mm_xor_si128(_mm_packs_epi32(lo_codes, hi_codes), sign_flip16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(codes + element), packed);
+    }
+#endif
+    for(; element < end_element; ++element)
+    {
+        i32 axis = static_cast<i32>(element % 3);
+        f32 code = (positions[element] - chunk.min[axis]) * scale[axis];
+        code = std::min(std::max(code, 0.0f), QUANTIZED_MAX_CODE);
+        codes[element] = static_cast<u16>(lrintf(code));
+    }
+}
+
+#endif
@@ -1,25 +1,15 @@
 #include <iostream>
 #include <fstream>
-#include <string>
-#include <chrono>
-#include <span>
 #include <cassert>
 #include <charconv>
-#include <array>
 #include <algorithm>
 
-
-#include "external/glad/glad.h"
-
-#include "defintions.h"
+#include "renderer.h"
+#include "glextensions.h"
 #include "arena.h"
-#include "utility.h"
-#include "defintions.h"
-#include "glmath.h"
-
-
-
-
+#include "threading.h"
+#include "cull.h"
+#include "ply.h"
 
 
 i64 compileShader(std::string_view shader_blob, GLenum shaderType)
@@ -54,252 +44,380 @@ i64 compileShader(std::string_view shader_blob, GLenum shaderType)
 
 
 
-struct VertexPosNormal
-{
-    glmath::Vec3 pos;
-    glmath::Vec3 normal;
-};
-
-
+extern char _binary_vertexShader_glsl_start;
+extern char _binary_vertexShader_glsl_end;
+extern char _binary_fragmentShader_glsl_start;
+extern char _binary_fragmentShader_glsl_end;
+extern char _binary_depthSortCS_glsl_start;
+extern char _binary_depthSortCS_glsl_end;
 
-struct ModelVertexData
-{
-    i32 vertex_offset;
-    i32 index_offset;
-    u32 n_verts;
-    u32 n_indices;
-};
 
-struct ModelMetaData
+std::string_view loadBlobFromBinary(StackArena &arena, const char &start, const char &end)
 {
-    std::string_view blob;
-    u32 nVerts;
-    u32 nTriangles;
-    u32 modelDataOffset;
-};
+    const char *blob_start = &start;
+    const char *blob_end = &end;
+    i64 size = std::bit_cast<intptr_t, const char*>(blob_end) -std::bit_cast<intptr_t, const char*>(blob_start);
 
-void getPlyMetaData(ModelMetaData &metaData)
-{
-    constexpr char vertexNumberPreface[] = "vertex ";
-    constexpr u8 vertexNumberPrefaceLength = 7;
-    constexpr char faceNumberPreface[] = "face ";
-    constexpr u8 faceNumberPrefaceLength = 5;
-    constexpr char modelDataPreface[] = "end_header\n";
-    constexpr u8 modelDataPrefaceLength = 11;
+    char* buffer = arena.arenaPush<char>(size);
+    memcpy(buffer, blob_start, size);
 
-    u32 vertexNumberOffset =static_cast<u32>(metaData.blob.find(vertexNumberPreface) + vertexNumberPrefaceLength);
 
-    u32 vertexNumberEnd = vertexNumberOffset;
-    while(metaData.blob[vertexNumberEnd] != '\n') ++vertexNumberEnd;
+    assert(size > 0 );
+    return {buffer, static_cast<u64>(size)};
+}
 
-    u32 faceNumberOffset = static_cast<u32>(metaData.blob.find(faceNumberPreface) + faceNumberPrefaceLength);
-    u32 faceNumberEnd = faceNumberOffset;
-    while(metaData.blob[faceNumberEnd] != '\n') ++faceNumberEnd;
 
-    metaData.nVerts = stringToU32(&metaData.blob[vertexNumberOffset],vertexNumberEnd - vertexNumberOffset);
-    metaData.nTriangles = stringToU32(&metaData.blob[faceNumberOffset], faceNumberEnd - faceNumberOffset);
-    metaData.modelDataOffset = static_cast<u32>(metaData.blob.find(modelDataPreface) + modelDataPrefaceLength);
-}
 
 
-void loadIndices(SubArena &indexDataArena, const ModelMetaData& modelInfo, i64 offset)
+void destroyParticleRing(ParticleRing &ring)
 {
-    i32* indices = indexDataArena.arenaPush<i32>(modelInfo.nTriangles * 3);
-    // Assume that all faces are triangles
-    for(u32 i = 0; i < modelInfo.nTriangles; ++i)
+    if(!ring.buffer)
+        return;
+    for(GLsync &fence : ring.fences)
     {
-        // replace reinterpret_cast with memcpy
-        u8 face_number = *reinterpret_cast<const u8*>(&modelInfo.blob[offset]); 
-        offset += 1; // skip number of vertices in the face
-        RENDERER_ASSERT(face_number == 3, "Mesh is not all triangles.");
-
-        indices[i * 3] = *reinterpret_cast<const u32*>(&modelInfo.blob[offset]);
-        offset += 4;
-        indices[i * 3 + 1] = *reinterpret_cast<const u32*>(&modelInfo.blob[offset]);
-        offset += 4;
-        indices[i * 3 + 2] = *reinterpret_cast<const u32*>(&modelInfo.blob[offset]);
-        offset += 4;
+        if(fence)
+        {
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
     }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ring.buffer);
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glDeleteBuffers(1, &ring.buffer);
+    ring = {};
 }
 
-void loadPlyModelPos(SubArena& vertexDataArena, SubArena& indexDataArena,ModelMetaData modelInfo)
+void createParticleRing(ParticleRing &ring, i64 slot_bytes, i32 offset_alignment)
 {
-    i64 offset = modelInfo.modelDataOffset;
-    VertexPosNormal* vertices_pos_normal = vertexDataArena.arenaPush<VertexPosNormal>(modelInfo.nVerts);
-    for(u32 i = 0; i < modelInfo.nVerts; ++i)
-    {
-        f32 x = *reinterpret_cast<const f32*>(&modelInfo.blob[offset]);
-        offset += 4;
-        f32 y = *reinterpret_cast<const f32*>(&modelInfo.blob[offset]);
-        offset += 4;
-        f32 z = *reinterpret_cast<const f32*>(&modelInfo.blob[offset]);
-        offset += 4;
+    destroyParticleRing(ring);
 
-        f32 nx = *reinterpret_cast<const f32*>(&modelInfo.blob[offset]);
-        offset += 4;
-        f32 ny = *reinterpret_cast<const f32*>(&modelInfo.blob[offset]);
-        offset += 4;
-        f32 nz = *reinterpret_cast<const f32*>(&modelInfo.blob[offset]);
-        offset += 4;
-        vertices_pos_normal[i] = {
-                        glmath::Vec3(x,y,z),
-                        glmath::Vec3(nx,ny,nz)
-                    };
-    }
-    loadIndices(indexDataArena,modelInfo,offset);
-}
+    ring.slot_stride_bytes = (slot_bytes + offset_alignment - 1) / offset_alignment * offset_alignment;
 
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    const i64 total_bytes = ring.slot_stride_bytes * PARTICLE_RING_SLOTS;
+    glGenBuffers(1, &ring.buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ring.buffer);
+    gl_extensions.bufferStorage(GL_SHADER_STORAGE_BUFFER, total_bytes, nullptr, flags);
+    ring.mapped = static_cast<u8*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, total_bytes, flags));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    RENDERER_ASSERT(ring.mapped != nullptr, "Failed to persistently map %lld bytes for the particle ring.", total_bytes);
+}
 
-struct Line
+// Returns where slot_bytes can be written for the next draw: the current ring
+// slot, once the GPU has finished with it. Grows the ring when it is too small.
+u8 *acquireRingSlot(ParticleRing &ring, i64 slot_bytes, i32 offset_alignment)
 {
-    glmath::Vec3 points[2];
-    Line(glmath::Vec3 p1, glmath::Vec3 p2)
-    {
-        points[0] = p1;
-        points[1] = p2;
-    }
-    Line()
+    if(ring.slot_stride_bytes < slot_bytes)
+        createParticleRing(ring, std::max(slot_bytes, ring.slot_stride_bytes + ring.slot_stride_bytes / 2), offset_alignment);
+
+    GLsync &fence = ring.fences[ring.slot];
+    if(fence)
     {
-        points[0] = {0.0,0.0,0.0};
-        points[1] = {0.0,0.0,0.0};
+        constexpr u64 one_second_ns = 1000000000;
+        GLenum wait_result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, one_second_ns);
+        while(wait_result == GL_TIMEOUT_EXPIRED)
+            wait_result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, one_second_ns);
+        RENDERER_ASSERT(wait_result != GL_WAIT_FAILED, "Waiting on the particle ring fence failed.");
+        glDeleteSync(fence);
+        fence = nullptr;
     }
+    return ring.mapped + ring.slot * ring.slot_stride_bytes;
+}
 
-};
-struct DebugAABB
+void releaseRingSlot(ParticleRing &ring)
 {
-    glmath::Vec3 verts[24];
-   
+    ring.fences[ring.slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ring.slot = (ring.slot + 1) % PARTICLE_RING_SLOTS;
+}
 
-    DebugAABB(glmath::Vec3 bl, glmath::Vec3 tr)
+void setUploadMode(Renderer &renderer, UploadMode mode)
+{
+    if(mode == UploadMode::PERSISTENT_RING && !gl_extensions.bufferStorage)
     {
-        f32 width  = tr.x - bl.x;
-        f32 height = tr.y - bl.y;
-        f32 depth  = tr.z - bl.z;
-
-        // bottom
-        verts[0] = {bl.x, bl.y , bl.z};
-        verts[1] = {bl.x + width, bl.y, bl.z};
-
-        verts[2] = {bl.x + width, bl.y, bl.z};
-        verts[3] = {bl.x + width, bl.y, bl.z + depth};
-
-        verts[4] = {bl.x + width, bl.y, bl.z + depth};
-        verts[5] = {bl.x, bl.y, bl.z + depth};
-
-        verts[6] = {bl.x, bl.y , bl.z};
-        verts[7] = {bl.x, bl.y, bl.z + depth};
-
-        //top 
-        verts[8] = {bl.x, bl.y + height , bl.z} ;
-        verts[9] = {bl.x + width, bl.y + height, bl.z};
-
-        verts[10] = {bl.x + width, bl.y + height, bl.z};
-        verts[11] = {bl.x + width, bl.y + height, bl.z + depth};
-
-        verts[12] = {bl.x + width, bl.y + height, bl.z + depth};
-        verts[13] = {bl.x, bl.y + height, bl.z + depth};
+        RENDERER_LOG("glBufferStorage is unavailable, falling back to glBufferSubData uploads.");
+        mode = UploadMode::BUFFER_SUB_DATA;
+    }
+    if(mode != UploadMode::PERSISTENT_RING)
+        destroyParticleRing(renderer.particle_ring);
+    renderer.upload_mode = mode;
+}
 
-        verts[14] = {bl.x, bl.y + height, bl.z} ;
-        verts[15] = {bl.x, bl.y + height, bl.z + depth};
+bool usesCompactStreams(ParticleLayout layout)
+{
+    return layout != ParticleLayout::INTERLEAVED;
+}
 
-        //pillars
-        verts[16] = {bl.x, bl.y , bl.z};
-        verts[17] = {bl.x, bl.y + height, bl.z};
+i64 particleCount(const Renderer &renderer)
+{
+    if(usesCompactStreams(renderer.particle_layout))
+        return static_cast<i64>(renderer.compact_colours.size());
+    return static_cast<i64>(renderer.particle_data.size());
+}
 
-        verts[18] = {bl.x + width, bl.y , bl.z};
-        verts[19] = {bl.x + width, bl.y + height, bl.z};
+void addParticleStream(ParticleStreams &streams, i32 offset_alignment, u32 binding, const void *data, i64 bytes)
+{
+    RENDERER_ASSERT(streams.n_streams < MAX_PARTICLE_STREAMS, "Too many particle streams.");
+    i64 offset = (streams.total_bytes + offset_alignment - 1) / offset_alignment * offset_alignment;
+    streams.streams[streams.n_streams++] = {binding, data, bytes, offset};
+    streams.total_bytes = offset + bytes;
+}
 
-        verts[20] = {bl.x + width, bl.y, bl.z + depth};
-        verts[21] = {bl.x + width, bl.y + height, bl.z + depth};
+// Describes the SSBO ranges a frame of n_particles needs in the given layout.
+// Stream data pointers may be null when only the sizes are needed. Compact
+// layouts get no draw order stream without a draw_order, the GPU sort binds its own.
+ParticleStreams particleStreams(const Renderer &renderer, ParticleLayout layout, i64 n_particles, const u32 *draw_order)
+{
+    ParticleStreams streams = {};
+    const i32 alignment = renderer.ssbo_offset_alignment;
+    if(layout == ParticleLayout::INTERLEAVED)
+    {
+        addParticleStream(streams, alignment, PARTICLE_BINDING, renderer.particle_data.data(), n_particles * sizeof(ParticleData));
+        return streams;
+    }
 
-        verts[22] = {bl.x, bl.y, bl.z + depth};
-        verts[23] = {bl.x, bl.y + height, bl.z + depth};
+    if(layout == ParticleLayout::QUANTIZED)
+    {
+        // u16 codes are read as uints, so round the stream up to whole words
+        const i64 code_bytes = (n_particles * 3 * sizeof(u16) + 3) / 4 * 4;
+        addParticleStream(streams, alignment, QUANTIZED_POSITION_BINDING, renderer.quantized_positions.data(), code_bytes);
+        addParticleStream(streams, alignment, QUANTIZED_CHUNK_BINDING, renderer.quantized_chunks.data(), renderer.quantized_chunks.size() * sizeof(QuantizedChunk));
+        // The chunks that kept float positions, which the compact position binding holds instead
+        if(!renderer.float_chunk_positions.empty())
+            addParticleStream(streams, alignment, COMPACT_POSITION_BINDING, renderer.float_chunk_positions.data(), renderer.float_chunk_positions.size() * sizeof(f32));
     }
-    DebugAABB()
+    else
     {
-        memset(verts,0,sizeof(verts));
+        addParticleStream(streams, alignment, COMPACT_POSITION_BINDING, renderer.compact_positions.data(), n_particles * 3 * sizeof(f32));
     }
+    addParticleStream(streams, alignment, COMPACT_COLOUR_BINDING, renderer.compact_colours.data(), n_particles * sizeof(u32));
+    if(draw_order)
+        addParticleStream(streams, alignment, DRAW_ORDER_BINDING, draw_order, n_particles * sizeof(u32));
+    return streams;
+}
 
-};
-
-constexpr i32 MAX_DEBUG_LINES = 10;
-constexpr i32 MAX_DEBUG_AABB = 10;
-constexpr i32 MAX_POINT_LIGHTS = 1;
-
-
-// use vec4 given that in std340/std130 vec3 has an alignment of 16 bytes
-struct ParticleData
+// Where a reordering pass should write this frame's interleaved particles:
+// straight into the ring slot when uploading through the ring, otherwise into
+// scratch memory.
+ParticleData *particleStagingDestination(Renderer &renderer, i64 n_particles)
 {
-    glmath::Vec4 position;
-    glmath::Vec4 colour;
-};
+    if(renderer.upload_mode == UploadMode::PERSISTENT_RING)
+    {
+        const ParticleStreams streams = particleStreams(renderer, ParticleLayout::INTERLEAVED, n_particles, nullptr);
+        renderer.staged_slot = acquireRingSlot(renderer.particle_ring, streams.total_bytes, renderer.ssbo_offset_alignment);
+        return reinterpret_cast<ParticleData*>(renderer.staged_slot);
+    }
+    renderer.sorted_particle_data.resize(n_particles);
+    return renderer.sorted_particle_data.data();
+}
 
-struct Renderer
+// Makes a staged destination the frame's particle array when it is not the ring.
+void commitStagedParticles(Renderer &renderer)
 {
-    SubArena debug_render_data; 
-    std::span<DebugAABB> debug_aabb;
-    std::span<Line> debug_lines;
-    std::span<glmath::Vec3> colour;
-
-    // SubArena dynamic_render_data; 
-    // std::span<ParticleData> particle_data;
-    // std::span<glmath::Vec4> light_pos;
-    std::vector<ParticleData> particle_data;
-    std::array<glmath::Vec3, MAX_POINT_LIGHTS> light_pos;
-
-    i64 dynamic_sso_capacity;
-    u32 dynamic_sso;
+    if(renderer.upload_mode != UploadMode::PERSISTENT_RING)
+        renderer.particle_data.swap(renderer.sorted_particle_data);
+}
 
-    u32 debug_vao;
-    u32 dummy_vao; 
+void clearParticles(Renderer &renderer)
+{
+    renderer.particle_data.clear();
+    renderer.compact_positions.clear();
+    renderer.compact_colours.clear();
+    renderer.quantized_positions.clear();
+    renderer.quantized_chunks.clear();
+    renderer.float_chunk_positions.clear();
+    renderer.draw_groups.clear();
+    renderer.draw_order_ready = false;
+    renderer.n_opaque_particles = 0;
+    renderer.gpu_sort_pending = false;
+    renderer.staged_slot = nullptr;
+}
 
-    i32 debug_colours_uniform;
+void setParticleLayout(Renderer &renderer, ParticleLayout layout)
+{
+    RENDERER_ASSERT(renderer.staged_slot == nullptr, "Can't change the particle layout while a frame is staged.");
+    clearParticles(renderer);
+    renderer.particle_layout = layout;
+}
 
-    i32 shader_program;
 
-    i32 render_mode_uniform;
-    i32 projection_uniform;
-    i32 view_uniform;
-    i32 point_light_uniform;
 
-    i32 particle_radius_uniform;
-};
+bool createGpuSort(GpuSort &sort, std::string_view shader_blob)
+{
+    sort = {};
+    i64 csObj = compileShader(shader_blob, GL_COMPUTE_SHADER);
+    RENDERER_ASSERT(csObj != -1, "Failed to compile the depth sort shader.");
 
+    sort.program = glCreateProgram();
+    glAttachShader(sort.program, static_cast<u32>(csObj));
+    glLinkProgram(sort.program);
+    i32 programCreated;
+    glGetProgramiv(sort.program, GL_LINK_STATUS, &programCreated);
+    if(!programCreated)
+    {
+        i32 length;
+        glGetProgramiv(sort.program, GL_INFO_LOG_LENGTH, &length);
+        char *log = new char[length];
+        glGetProgramInfoLog(sort.program, length, NULL, log);
+        RENDERER_LOG(log);
+        delete[] log;
+        return false;
+    }
 
+    sort.stage_uniform = glGetUniformLocation(sort.program, "sort_stage");
+    sort.particle_layout_uniform = glGetUniformLocation(sort.program, "particle_layout");
+    sort.n_particles_uniform = glGetUniformLocation(sort.program, "n_particles");
+    sort.merge_size_uniform = glGetUniformLocation(sort.program, "merge_size");
+    sort.compare_distance_uniform = glGetUniformLocation(sort.program, "compare_distance");
+    sort.camera_pos_uniform = glGetUniformLocation(sort.program, "camera_pos_ws");
 
+    glGenBuffers(1, &sort.buffer);
+    glGenQueries(1, &sort.timer_query);
+    return true;
+}
 
-extern char _binary_vertexShader_glsl_start;
-extern char _binary_vertexShader_glsl_end;
-extern char _binary_fragmentShader_glsl_start;
-extern char _binary_fragmentShader_glsl_end;
 
 
-std::string_view loadBlobFromBinary(StackArena &arena, const char &start, const char &end)
+// Unit icosphere with clockwise front faces, as glFrontFace(GL_CW) expects.
+void buildIcosphere(i32 subdivisions, std::vector<glmath::Vec3> &vertices, std::vector<u16> &indices)
 {
-    const char *blob_start = &start;
-    const char *blob_end = &end;
-    i64 size = std::bit_cast<intptr_t, const char*>(blob_end) -std::bit_cast<intptr_t, const char*>(blob_start);
+    const f32 t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+    vertices = {{-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0}, {0, -1, t}, {0, 1, t},
+                {0, -1, -t}, {0, 1, -t}, {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}};
+    indices = {0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11, 1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+               3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9, 4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1};
+    for(glmath::Vec3 &vertex : vertices)
+        vertex = glmath::normalise(vertex);
+
+    // Each subdivision splits every triangle in four through its edge midpoints, shared between neighbours.
+    for(i32 level = 0; level < subdivisions; ++level)
+    {
+        std::vector<std::pair<u32, u16>> midpoints;
+        auto midpoint = [&](u16 a, u16 b)
+        {
+            const u32 key = static_cast<u32>(std::min(a, b)) << 16 | std::max(a, b);
+            for(const auto &[edge, index] : midpoints)
+                if(edge == key)
+                    return index;
+            vertices.push_back(glmath::normalise(vertices[a] + vertices[b]));
+            midpoints.push_back({key, static_cast<u16>(vertices.size() - 1)});
+            return midpoints.back().second;
+        };
+        std::vector<u16> split;
+        for(u64 i = 0; i < indices.size(); i += 3)
+        {
+            const u16 a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            const u16 ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            split.insert(split.end(), {a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca});
+        }
+        indices.swap(split);
+    }
 
-    char* buffer = arena.arenaPush<char>(size);
-    memcpy(buffer, blob_start, size);
+    for(u64 i = 0; i < indices.size(); i += 3)
+    {
+        const glmath::Vec3 &a = vertices[indices[i]], &b = vertices[indices[i + 1]], &c = vertices[indices[i + 2]];
+        if(glmath::dot(glmath::cross(b - a, c - a), a + b + c) < 0.0f)
+            std::swap(indices[i + 1], indices[i + 2]);
+    }
+}
 
+// Uploads the icosphere SphereMode::MESH draws: vertices as an SSBO the vertex
+// shader indexes, indices bound to the particle VAO.
+void createSphereMesh(Renderer &renderer)
+{
+    std::vector<glmath::Vec3> vertices;
+    std::vector<u16> indices;
+    buildIcosphere(SPHERE_MESH_SUBDIVISIONS, vertices, indices);
+    std::vector<glmath::Vec4> padded(vertices.size());
+    for(u64 i = 0; i < vertices.size(); ++i)
+        padded[i] = glmath::Vec4(vertices[i].x, vertices[i].y, vertices[i].z, 0.0f);
+
+    glGenBuffers(1, &renderer.sphere_mesh_vertices);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer.sphere_mesh_vertices);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, padded.size() * sizeof(glmath::Vec4), padded.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SPHERE_MESH_BINDING, renderer.sphere_mesh_vertices);
 
-    assert(size > 0 );
-    return {buffer, static_cast<u64>(size)};
+    glBindVertexArray(renderer.dummy_vao);
+    glGenBuffers(1, &renderer.sphere_mesh_indices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer.sphere_mesh_indices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(u16), indices.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+    renderer.n_sphere_mesh_indices = static_cast<i32>(indices.size());
 }
 
+i32 linkProgram(i64 vsObj, i64 fsObj)
+{
+    i32 program = glCreateProgram();
+    glAttachShader(program,static_cast<u32>(vsObj));
+    glAttachShader(program,static_cast<u32>(fsObj));
+    glLinkProgram(program);
+    i32 programCreated;
+    glGetProgramiv(program,GL_LINK_STATUS,&programCreated);
+    if(!programCreated)
+    {
+        i32 length;
+        glGetProgramiv(program,GL_INFO_LOG_LENGTH, &length);
+        char *log = new char[length];
+        glGetProgramInfoLog(program,length,NULL,log);
+        RENDERER_LOG(log);
+        delete[] log;
+        return -1;
+    }
+    return program;
+}
 
+// Binds the particle program variant of the current sphere mode. Uniform values
+// belong to a program, so frames pick the variant before setting any, and its
+// locations are looked up again whenever the variant changes.
+void useParticleProgram(Renderer &renderer)
+{
+    const i32 program = renderer.sphere_mode == SphereMode::RAY_CAST ? renderer.ray_cast_program : renderer.fixed_depth_program;
+    glUseProgram(program);
+    if(program == renderer.shader_program)
+        return;
+    renderer.shader_program = program;
+
+    renderer.projection_uniform = glGetUniformLocation(renderer.shader_program,"projection");
+    renderer.view_uniform = glGetUniformLocation(renderer.shader_program,"view");
+    renderer.point_light_uniform = glGetUniformLocation(renderer.shader_program,"point_lights_ws");
+
+
+    // assert(renderer.mvp_uniform != -1);
+    renderer.render_mode_uniform = glGetUniformLocation(renderer.shader_program,"render_mode");
+    assert(renderer.render_mode_uniform != -1);
+    renderer.n_draw_groups_uniform = glGetUniformLocation(renderer.shader_program,"n_draw_groups");
+    renderer.particle_layout_uniform = glGetUniformLocation(renderer.shader_program,"particle_layout");
+    renderer.gpu_sorted_uniform = glGetUniformLocation(renderer.shader_program,"gpu_sorted");
+    renderer.quad_path_uniform = glGetUniformLocation(renderer.shader_program,"quad_path");
+    renderer.billboard_right_uniform = glGetUniformLocation(renderer.shader_program,"billboard_right");
+    renderer.billboard_up_uniform = glGetUniformLocation(renderer.shader_program,"billboard_up");
+    renderer.view_projection_uniform = glGetUniformLocation(renderer.shader_program,"view_projection");
+    renderer.first_particle_uniform = glGetUniformLocation(renderer.shader_program,"first_particle");
+    renderer.sphere_mode_uniform = glGetUniformLocation(renderer.shader_program,"sphere_mode");
+    renderer.count_fragments_uniform = glGetUniformLocation(renderer.shader_program,"count_fragments");
+    renderer.blend_mode_uniform = glGetUniformLocation(renderer.shader_program,"blend_mode");
+    renderer.oit_accumulation_uniform = glGetUniformLocation(renderer.shader_program,"oit_accumulation");
+    renderer.oit_revealage_uniform = glGetUniformLocation(renderer.shader_program,"oit_revealage");
+    // assert(renderer.particle_scale_uniform != -1);
+    renderer.debug_colours_uniform = glGetUniformLocation(renderer.shader_program,"debugColours");
+    // assert(renderer.debug_colours_uniform != -1);
 
+    // Set shader defaults
+    glUniform1i(renderer.oit_accumulation_uniform, 0);
+    glUniform1i(renderer.oit_revealage_uniform, 1);
+}
 
 i32 initialiseRenderer(Renderer &render_manager)
 {
     // RENDERER_ASSERT(glXGetCurrentContext() != nullptr, "Called on thread without a valid context.");
 
-    StackArena shader_data {1024 * 10}; // NOTE: 10 KiB is over allocation
+    StackArena shader_data {1024 * 32}; // NOTE: 32 KiB is over allocation
     ModelMetaData metaData;
 
     glGenVertexArrays(1, &render_manager.dummy_vao);
-    
+    createSphereMesh(render_manager);
 
     constexpr i32 point_light_size = MAX_POINT_LIGHTS * sizeof(glmath::Vec4);
     constexpr i32 nDebugEntites = MAX_DEBUG_AABB + MAX_DEBUG_LINES;
@@ -314,7 +432,30 @@ i32 initialiseRenderer(Renderer &render_manager)
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER,3,render_manager.dynamic_sso);
     glBufferData(GL_SHADER_STORAGE_BUFFER, 32, nullptr,GL_DYNAMIC_DRAW);    
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-    render_manager.dynamic_sso_capacity = 0;
+    render_manager.dynamic_sso_capacity_bytes = 0;
+    for(u32 binding : {COMPACT_POSITION_BINDING, COMPACT_COLOUR_BINDING, DRAW_ORDER_BINDING})
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, render_manager.dynamic_sso);
+    glGenBuffers(1, &render_manager.draw_group_buffer);
+    render_manager.draw_group_capacity_bytes = 0;
+
+    render_manager.ssbo_offset_alignment = 1;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &render_manager.ssbo_offset_alignment);
+
+    render_manager.particle_ring = {};
+    render_manager.staged_slot = nullptr;
+    render_manager.particle_layout = ParticleLayout::INTERLEAVED;
+    render_manager.draw_order_ready = false;
+    render_manager.n_opaque_particles = 0;
+    render_manager.gpu_sort_pending = false;
+    render_manager.frustum_culling = true;
+    render_manager.cull_stats = {};
+    render_manager.particle_radius = 0.005f;
+    render_manager.quantization_tolerance = 0.05f;
+    render_manager.quantization_error = 0.0f;
+    render_manager.blend_mode = BlendMode::SORTED;
+    render_manager.oit_targets = {};
+    render_manager.readback_ring = {};
+    setUploadMode(render_manager, UploadMode::PERSISTENT_RING);
 
 
 
@@ -344,57 +485,268 @@ i32 initialiseRenderer(Renderer &render_manager)
 
     auto vert_blob = loadBlobFromBinary(shader_data, _binary_vertexShader_glsl_start, _binary_vertexShader_glsl_end);
     auto frag_blob = loadBlobFromBinary(shader_data, _binary_fragmentShader_glsl_start, _binary_fragmentShader_glsl_end);
+    // The ray cast variant defines RAY_CAST_DEPTH after the #version line
+    const u64 version_end = frag_blob.find('\n') + 1;
+    const std::string ray_cast_frag = std::string(frag_blob.substr(0, version_end)) + "#define RAY_CAST_DEPTH\n" + std::string(frag_blob.substr(version_end));
     i64 vsObj = compileShader(vert_blob, GL_VERTEX_SHADER);
     i64 fsObj = compileShader(frag_blob, GL_FRAGMENT_SHADER);
-    RENDERER_ASSERT(vsObj != -1 && fsObj != -1, "Failed to compile shaders.");
+    i64 rayCastFsObj = compileShader(ray_cast_frag, GL_FRAGMENT_SHADER);
+    RENDERER_ASSERT(vsObj != -1 && fsObj != -1 && rayCastFsObj != -1, "Failed to compile shaders.");
 
-    
-    render_manager.shader_program = glCreateProgram();
-    glAttachShader(render_manager.shader_program,static_cast<u32>(vsObj));
-    glAttachShader(render_manager.shader_program,static_cast<u32>(fsObj));
-    glLinkProgram(render_manager.shader_program);
-    i32 programCreated;
-    glGetProgramiv(render_manager.shader_program,GL_LINK_STATUS,&programCreated);
-    if(!programCreated)
-    {
-        i32 length;
-        glGetProgramiv(render_manager.shader_program,GL_INFO_LOG_LENGTH, &length);
-        char *log = new char[length];
-        glGetProgramInfoLog(render_manager.shader_program,length,NULL,log);
-        RENDERER_LOG(log);
-        delete[] log;
+    render_manager.fixed_depth_program = linkProgram(vsObj, fsObj);
+    render_manager.ray_cast_program = linkProgram(vsObj, rayCastFsObj);
+    if(render_manager.fixed_depth_program == -1 || render_manager.ray_cast_program == -1)
         return -1;
-    }
+    render_manager.shader_program = -1;
+    useParticleProgram(render_manager);
 
-    render_manager.projection_uniform = glGetUniformLocation(render_manager.shader_program,"projection");
-    render_manager.view_uniform = glGetUniformLocation(render_manager.shader_program,"view");
-    render_manager.point_light_uniform = glGetUniformLocation(render_manager.shader_program,"point_lights_ws");
+    auto sort_blob = loadBlobFromBinary(shader_data, _binary_depthSortCS_glsl_start, _binary_depthSortCS_glsl_end);
+    if(!createGpuSort(render_manager.gpu_sort, sort_blob))
+        return -1;
+    glUseProgram(render_manager.shader_program);
 
 
-    // assert(render_manager.mvp_uniform != -1);
-    render_manager.render_mode_uniform = glGetUniformLocation(render_manager.shader_program,"render_mode");
-    assert(render_manager.render_mode_uniform != -1);
-    render_manager.particle_radius_uniform = glGetUniformLocation(render_manager.shader_program,"radius");
-    // assert(render_manager.particle_scale_uniform != -1);
-    render_manager.debug_colours_uniform = glGetUniformLocation(render_manager.shader_program,"debugColours");
-    // assert(render_manager.debug_colours_uniform != -1);
 
-    // Set shader defaults
-    glUseProgram(render_manager.shader_program);
-    glUniform1f(render_manager.particle_radius_uniform, 0.005f);
+    return 1;
+}
 
 
 
-    return 1;
+
+f64 millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    const std::chrono::duration<f64, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
 }
 
 
+constexpr i64 CULL_MIN_BATCH = 1 << 14;
 
+// Sets particle_visible for every particle against the view volume, leaving
+// the visible count of each CULL_MIN_BATCH batch in cull_counts.
+void markVisibleParticles(Renderer &renderer, const glmath::Mat4x4 &view_projection)
+{
+    const i64 n_particles = particleCount(renderer);
+
+    // Spheres are tested against the largest radius of the frame, which may
+    // keep a few small particles just outside the view but never drops one inside.
+    f32 max_radius = 0.0f;
+    for(const DrawGroup &group : renderer.draw_groups)
+        max_radius = std::max(max_radius, group.radius);
+
+    const Frustum frustum = frustumFromViewProjection(view_projection);
+    const bool compact = usesCompactStreams(renderer.particle_layout);
+    const f32 *positions = compact ? renderer.compact_positions.data() : renderer.particle_data.data()->position.data;
+    const i64 stride = compact ? 3 : sizeof(ParticleData) / sizeof(f32);
+    renderer.particle_visible.resize(n_particles);
+    u8 *visible = renderer.particle_visible.data();
+
+    const i32 n_batches = batchCount(n_particles, CULL_MIN_BATCH);
+    const i64 batch_size = (n_particles + n_batches - 1) / n_batches;
+    renderer.cull_counts.resize(n_batches);
+    globalThreadPool().run(n_batches, [&](i32 batch)
+    {
+        i64 begin = std::min(n_particles, batch * batch_size);
+        i64 end = std::min(n_particles, begin + batch_size);
+        renderer.cull_counts[batch] = cullSpheres(frustum, positions, stride, max_radius, begin, end, visible);
+    });
+}
 
-void sortParticlesByDepth(Renderer &renderer, const glmath::Vec3 &camera_pos)
+// Drops the particles whose sphere lies entirely outside the view volume,
+// keeping the survivors in order, so that sorting and upload only see particles
+// that can be visible. One pass tests every sphere and counts survivors per
+// batch, a second compacts them in parallel into scratch that is then swapped in.
+void cullParticles(Renderer &renderer, const glmath::Mat4x4 &view_projection)
 {
-    
-    std::sort(renderer.particle_data.begin(), renderer.particle_data.end(), [camera_pos](const ParticleData &a, const ParticleData &b)
+    const auto cull_start = std::chrono::steady_clock::now();
+    const i64 n_particles = particleCount(renderer);
+    renderer.cull_stats = {};
+    renderer.cull_stats.n_visible = n_particles;
+    if(!renderer.frustum_culling || n_particles == 0)
+        return;
+
+    markVisibleParticles(renderer, view_projection);
+    const bool compact = usesCompactStreams(renderer.particle_layout);
+    const u8 *visible = renderer.particle_visible.data();
+    const i32 n_batches = batchCount(n_particles, CULL_MIN_BATCH);
+    const i64 batch_size = (n_particles + n_batches - 1) / n_batches;
+
+    i64 n_visible = 0;
+    for(i32 batch = 0; batch < n_batches; ++batch)
+    {
+        i64 n = renderer.cull_counts[batch];
+        renderer.cull_counts[batch] = n_visible;
+        n_visible += n;
+    }
+    renderer.cull_stats.n_visible = n_visible;
+    renderer.cull_stats.n_culled = n_particles - n_visible;
+
+    // Each group now starts after the survivors of the groups before it.
+    for(DrawGroup &group : renderer.draw_groups)
+    {
+        if(group.first >= n_particles)
+        {
+            group.first = n_visible;
+            continue;
+        }
+        const i64 batch = group.first / batch_size;
+        i64 first = renderer.cull_counts[batch];
+        for(i64 i = batch * batch_size; i < group.first; ++i)
+            first += visible[i];
+        group.first = first;
+    }
+
+    if(n_visible != n_particles)
+    {
+        if(compact)
+        {
+            renderer.culled_positions.resize(n_visible * 3);
+            renderer.culled_colours.resize(n_visible);
+        }
+        else
+        {
+            renderer.sorted_particle_data.resize(n_visible);
+        }
+        globalThreadPool().run(n_batches, [&](i32 batch)
+        {
+            i64 begin = std::min(n_particles, batch * batch_size);
+            i64 end = std::min(n_particles, begin + batch_size);
+            i64 out = renderer.cull_counts[batch];
+            for(i64 i = begin; i < end; ++i)
+            {
+                if(!visible[i])
+                    continue;
+                if(compact)
+                {
+                    memcpy(&renderer.culled_positions[out * 3], &renderer.compact_positions[i * 3], 3 * sizeof(f32));
+                    renderer.culled_colours[out] = renderer.compact_colours[i];
+                }
+                else
+                {
+                    renderer.sorted_particle_data[out] = renderer.particle_data[i];
+                }
+                ++out;
+            }
+        });
+        if(compact)
+        {
+            renderer.compact_positions.swap(renderer.culled_positions);
+            renderer.compact_colours.swap(renderer.culled_colours);
+        }
+        else
+        {
+            renderer.particle_data.swap(renderer.sorted_particle_data);
+        }
+    }
+    renderer.cull_stats.cull_ms = millisecondsSince(cull_start);
+}
+
+bool isOpaque(const ParticleData &particle)
+{
+    return particle.colour.w >= 1.0f;
+}
+
+// Writes sort_indices as [opaque | translucent] so that only the translucent
+// tail has to be depth sorted.
+void partitionParticlesByOpacity(Renderer &renderer)
+{
+    const i64 n_particles = particleCount(renderer);
+    renderer.sort_indices.resize(n_particles);
+    if(usesCompactStreams(renderer.particle_layout))
+    {
+        const u32 *colours = renderer.compact_colours.data();
+        renderer.n_opaque_particles = partitionIndices(n_particles, [&](i64 i){ return (colours[i] >> 24) == 0xFF; }, renderer.sort_indices.data(), renderer.partition_counts);
+    }
+    else
+    {
+        const ParticleData *particles = renderer.particle_data.data();
+        renderer.n_opaque_particles = partitionIndices(n_particles, [&](i64 i){ return isOpaque(particles[i]); }, renderer.sort_indices.data(), renderer.partition_counts);
+    }
+}
+
+// partitionParticlesByOpacity for one view of renderViews, leaving out the
+// particles markVisibleParticles found outside it, so sort_indices only holds
+// the visible ones.
+void partitionVisibleParticlesByOpacity(Renderer &renderer)
+{
+    const i64 n_particles = particleCount(renderer);
+    const bool compact = usesCompactStreams(renderer.particle_layout);
+    const u8 *visible = renderer.particle_visible.data();
+    renderer.sort_indices.resize(n_particles);
+    i64 n_visible = 0;
+    renderer.n_opaque_particles = partitionKeptIndices(n_particles, [&](i64 i)
+    {
+        if(!visible[i])
+            return 2u;
+        const bool opaque = compact ? (renderer.compact_colours[i] >> 24) == 0xFF : isOpaque(renderer.particle_data[i]);
+        return opaque ? 0u : 1u;
+    }, renderer.sort_indices.data(), renderer.partition_counts, n_visible);
+    renderer.sort_indices.resize(n_visible);
+}
+
+// Sets n_opaque_particles without ordering anything, for the GPU sort, which
+// keys opaque particles to the front of its draw order itself.
+void countOpaqueParticles(Renderer &renderer)
+{
+    const i64 n_particles = particleCount(renderer);
+    const bool compact = usesCompactStreams(renderer.particle_layout);
+    const i32 n_batches = batchCount(n_particles, RADIX_MIN_BATCH);
+    const i64 batch_size = (n_particles + n_batches - 1) / n_batches;
+    renderer.partition_counts.resize(n_batches);
+    globalThreadPool().run(n_batches, [&](i32 batch)
+    {
+        i64 begin = std::min(n_particles, batch * batch_size);
+        i64 end = std::min(n_particles, begin + batch_size);
+        i64 n_opaque = 0;
+        for(i64 i = begin; i < end; ++i)
+            n_opaque += compact ? (renderer.compact_colours[i] >> 24) == 0xFF : isOpaque(renderer.particle_data[i]);
+        renderer.partition_counts[batch] = n_opaque;
+    });
+    renderer.n_opaque_particles = 0;
+    for(i32 batch = 0; batch < n_batches; ++batch)
+        renderer.n_opaque_particles += renderer.partition_counts[batch];
+}
+
+// Squared distance from camera_pos of a particle, by index, in either layout.
+auto particleDistanceSquared(const Renderer &renderer, const glmath::Vec3 &camera_pos)
+{
+    const bool compact = usesCompactStreams(renderer.particle_layout);
+    const f32 *positions = compact ? renderer.compact_positions.data() : renderer.particle_data.data()->position.data;
+    const i64 stride = compact ? 3 : sizeof(ParticleData) / sizeof(f32);
+    return [=](u32 i)
+    {
+        const f32 *position = positions + i * stride;
+        f32 dx = camera_pos.x - position[0];
+        f32 dy = camera_pos.y - position[1];
+        f32 dz = camera_pos.z - position[2];
+        return dx * dx + dy * dy + dz * dz;
+    };
+}
+
+// Comparison sorts the translucent tail of sort_indices back to front, after
+// partitionParticlesByOpacity.
+void sortTranslucentStd(Renderer &renderer, const glmath::Vec3 &camera_pos)
+{
+    const auto distance_squared = particleDistanceSquared(renderer, camera_pos);
+    std::sort(renderer.sort_indices.begin() + renderer.n_opaque_particles, renderer.sort_indices.end(), [&](u32 a, u32 b)
+    {
+        return distance_squared(a) > distance_squared(b);
+    });
+}
+
+void sortParticlesByDepthStd(Renderer &renderer, const glmath::Vec3 &camera_pos)
+{
+    if(usesCompactStreams(renderer.particle_layout))
+    {
+        partitionParticlesByOpacity(renderer);
+        sortTranslucentStd(renderer, camera_pos);
+        renderer.draw_order_ready = true;
+        return;
+    }
+
+    auto translucent = std::stable_partition(renderer.particle_data.begin(), renderer.particle_data.end(), isOpaque);
+    renderer.n_opaque_particles = translucent - renderer.particle_data.begin();
+    std::sort(translucent, renderer.particle_data.end(), [camera_pos](const ParticleData &a, const ParticleData &b)
     {
         float distance_a = 0;
         float distance_b = 0;
@@ -407,66 +759,1212 @@ void sortParticlesByDepth(Renderer &renderer, const glmath::Vec3 &camera_pos)
     });
 }
 
-
-
-void renderDebug(const Renderer &renderer)
+// Radix sorts the translucent tail of sort_indices back to front, after
+// partitionParticlesByOpacity.
+void sortTranslucentRadix(Renderer &renderer, const glmath::Vec3 &camera_pos)
 {
-    // Assumes that shader program has been bound
+    // Opaque particles keep their order, only the translucent tail is keyed and sorted.
+    const i64 n_translucent = static_cast<i64>(renderer.sort_indices.size()) - renderer.n_opaque_particles;
+    u32 *translucent = renderer.sort_indices.data() + renderer.n_opaque_particles;
+    renderer.sort_keys.resize(n_translucent);
+
+    auto stage_start = std::chrono::steady_clock::now();
+    const auto distance_squared = particleDistanceSquared(renderer, camera_pos);
+    parallelFor(n_translucent, RADIX_MIN_BATCH, [&](i32, i64 begin, i64 end)
+    {
+        for(i64 i = begin; i < end; ++i)
+            renderer.sort_keys[i] = farToNearKey(distance_squared(translucent[i]));
+    });
+    renderer.sort_timings.keys_ms += millisecondsSince(stage_start);
 
-    glBindVertexArray(renderer.debug_vao);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, renderer.debug_render_data.offset, renderer.debug_render_data.start); //reupload
-    glLineWidth(2);
-    constexpr i32 nVerts = MAX_DEBUG_AABB * 24 + MAX_DEBUG_LINES * 2;
-    glDrawArrays(GL_LINES, 0 ,nVerts);
-    glBindVertexArray(0);
+    stage_start = std::chrono::steady_clock::now();
+    radixSortKeyIndex(renderer.sort_keys.data(), translucent, n_translucent, renderer.radix_scratch);
+    renderer.sort_timings.sort_ms += millisecondsSince(stage_start);
 }
 
+// Writes the draw order as seen from camera_pos to sort_indices, opaque
+// particles first and then the translucent ones back to front, without moving
+// any particles. Stage timings are added to sort_timings.
+void sortDrawOrderRadix(Renderer &renderer, const glmath::Vec3 &camera_pos)
+{
+    auto stage_start = std::chrono::steady_clock::now();
+    partitionParticlesByOpacity(renderer);
+    renderer.sort_timings.partition_ms += millisecondsSince(stage_start);
+    sortTranslucentRadix(renderer, camera_pos);
+}
 
-
-void uploadAndRenderParticles(Renderer & renderer)
+// Most frames TEMPORAL radix sorts before trying a repair again.
+constexpr i32 TEMPORAL_MAX_BACKOFF = 16;
+
+// Sorts the translucent tail of sort_indices for particles sent in the same
+// order every frame. The translucent order the last sort ended with is
+// re-keyed from camera_pos and repaired, close to linear time when particles
+// moved little. Falls back to the radix sort when that order no longer covers
+// exactly the tail, e.g. after culling or a change in count, or when the repair
+// finds particles moved too far. A repair that gave up isn't tried again for a
+// number of frames that doubles each time, so a fast moving simulation pays
+// for it rarely.
+void sortTranslucentTemporal(Renderer &renderer, const glmath::Vec3 &camera_pos)
 {
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER,renderer.dynamic_sso);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,3,renderer.dynamic_sso);
-    if(renderer.dynamic_sso_capacity < static_cast<i64>(renderer.particle_data.size()))
+    const i64 n_particles = particleCount(renderer);
+    auto stage_start = std::chrono::steady_clock::now();
+    const i64 n_translucent = static_cast<i64>(renderer.sort_indices.size()) - renderer.n_opaque_particles;
+    u32 *translucent = renderer.sort_indices.data() + renderer.n_opaque_particles;
+    std::vector<u32> &previous_order = renderer.temporal_order;
+    renderer.sort_timings.disorder = -1.0;
+
+    // Keyed through the tail, which partitioning leaves in memory order, and
+    // then gathered through the previous order, as gathering the particles
+    // themselves would miss the cache on every one. farToNearKey sets the top
+    // bit of every key, so 0 marks a particle outside the tail; a previous
+    // order of the same size without any is a permutation of the tail.
+    bool reusable = n_translucent > 0 && static_cast<i64>(previous_order.size()) == n_translucent && renderer.temporal_frames_to_skip == 0;
+    renderer.temporal_frames_to_skip = std::max(renderer.temporal_frames_to_skip - 1, 0);
+    if(reusable)
     {
-        i32 new_size_bytes = renderer.particle_data.capacity() * sizeof(ParticleData);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, new_size_bytes, nullptr,GL_DYNAMIC_DRAW);
-        renderer.dynamic_sso_capacity = static_cast<i64>(renderer.particle_data.capacity());
+        const auto distance_squared = particleDistanceSquared(renderer, camera_pos);
+        renderer.sort_keys.resize(n_particles);
+        u32 *keys = renderer.sort_keys.data();
+        parallelFor(n_particles, RADIX_MIN_BATCH, [&](i32, i64 begin, i64 end)
+        {
+            std::fill(keys + begin, keys + end, 0u);
+        });
+        parallelFor(n_translucent, RADIX_MIN_BATCH, [&](i32, i64 begin, i64 end)
+        {
+            for(i64 i = begin; i < end; ++i)
+                keys[translucent[i]] = farToNearKey(distance_squared(translucent[i]));
+        });
+        renderer.temporal_pairs.resize(n_translucent);
+        std::atomic<bool> stale = false;
+        parallelFor(n_translucent, RADIX_MIN_BATCH, [&](i32, i64 begin, i64 end)
+        {
+            for(i64 i = begin; i < end; ++i)
+            {
+                const u32 index = previous_order[i];
+                const u32 key = index < n_particles ? keys[index] : 0;
+                if(key == 0)
+                {
+                    stale = true;
+                    return;
+                }
+                renderer.temporal_pairs[i] = keyIndexPair(key, index);
+            }
+        });
+        reusable = !stale;
+        renderer.sort_timings.keys_ms += millisecondsSince(stage_start);
     }
-    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, renderer.particle_data.size() * sizeof(ParticleData),renderer.particle_data.data());
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER,0);
-
 
-    // glDrawElementsInstanced(GL_TRIANGLES, 960 * 3, GL_UNSIGNED_INT, (void*)(0), renderer.particle_data.size());
-
-
-    glUniform1ui(renderer.render_mode_uniform, 1);
-    glDrawArrays(GL_TRIANGLES,0,6 * renderer.particle_data.size());
+    stage_start = std::chrono::steady_clock::now();
+    const i64 moves = reusable ? sortNearlySortedPairs(renderer.temporal_pairs.data(), n_translucent) : -1;
+    if(moves >= 0)
+    {
+        parallelFor(n_translucent, RADIX_MIN_BATCH, [&](i32, i64 begin, i64 end)
+        {
+            for(i64 i = begin; i < end; ++i)
+                translucent[i] = pairIndex(renderer.temporal_pairs[i]);
+        });
+        renderer.sort_timings.disorder = static_cast<f64>(moves) / static_cast<f64>(n_translucent);
+        renderer.temporal_backoff = 0;
+    }
+    else if(reusable)
+    {
+        renderer.temporal_backoff = std::clamp(renderer.temporal_backoff * 2, 1, TEMPORAL_MAX_BACKOFF);
+        renderer.temporal_frames_to_skip = renderer.temporal_backoff;
+    }
+    // A repair that gave up still counts towards the sort.
+    renderer.sort_timings.sort_ms += millisecondsSince(stage_start);
+    renderer.sort_timings.full_sort = moves < 0;
+    if(moves < 0)
+        sortTranslucentRadix(renderer, camera_pos);
+    previous_order.assign(translucent, translucent + n_translucent);
+}
 
-    
-    renderer.particle_data.clear();
+// sortDrawOrderRadix for particles sent in the same order every frame, see
+// sortTranslucentTemporal.
+void sortDrawOrderTemporal(Renderer &renderer, const glmath::Vec3 &camera_pos)
+{
+    auto stage_start = std::chrono::steady_clock::now();
+    partitionParticlesByOpacity(renderer);
+    renderer.sort_timings.partition_ms += millisecondsSince(stage_start);
+    sortTranslucentTemporal(renderer, camera_pos);
 }
 
-void renderScene(Renderer & renderer, const glmath::Mat4x4 &view, const glmath::Mat4x4 &projection)
+// Puts the particles in the draw order of sort_indices. The compact layouts
+// only mark it ready, the interleaved one gathers the particles into it.
+void applyDrawOrder(Renderer &renderer)
 {
-    // RENDERER_ASSERT(glXGetCurrentContext() != nullptr, "Called on thread without a valid context.");
+    // The compact layouts draw through the index stream, so the particles themselves never move.
+    if(usesCompactStreams(renderer.particle_layout))
+    {
+        renderer.draw_order_ready = true;
+        return;
+    }
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(renderer.shader_program);
-    glUniformMatrix4fv(renderer.projection_uniform, 1, false, projection.data[0]);
-    glUniformMatrix4fv(renderer.view_uniform, 1, false, view.data[0]);
+    const i64 n_particles = particleCount(renderer);
+    const auto stage_start = std::chrono::steady_clock::now();
+    ParticleData *sorted = particleStagingDestination(renderer, n_particles);
+    parallelFor(n_particles, RADIX_MIN_BATCH, [&](i32, i64 begin, i64 end)
+    {
+        for(i64 i = begin; i < end; ++i)
+            sorted[i] = renderer.particle_data[renderer.sort_indices[i]];
+    });
+    commitStagedParticles(renderer);
+    renderer.sort_timings.gather_ms = millisecondsSince(stage_start);
+}
 
-    renderer.light_pos[0] = glmath::Vec3(3.0, 3.0, 3.0);
+void sortParticlesByDepthRadix(Renderer &renderer, const glmath::Vec3 &camera_pos)
+{
+    if(renderer.sort_mode == SortMode::TEMPORAL)
+        sortDrawOrderTemporal(renderer, camera_pos);
+    else
+        sortDrawOrderRadix(renderer, camera_pos);
+    applyDrawOrder(renderer);
+}
 
+// Picks up the timer of an earlier GPU sort without waiting for it.
+void collectGpuSortTime(GpuSort &sort)
+{
+    if(!sort.timer_pending)
+        return;
+    u32 available = 0;
+    glGetQueryObjectuiv(sort.timer_query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available)
+        return;
+    GLuint64 elapsed_ns = 0;
+    glGetQueryObjectui64v(sort.timer_query, GL_QUERY_RESULT, &elapsed_ns);
+    sort.last_sort_ms = static_cast<f64>(elapsed_ns) / 1.0e6;
+    sort.timer_pending = false;
+}
 
+void sortParticlesByDepth(Renderer &renderer, const glmath::Vec3 &camera_pos)
+{
+    const auto sort_start = std::chrono::steady_clock::now();
+    renderer.sort_timings = {};
+    renderer.sort_timings.n_particles = particleCount(renderer);
 
-    for(i32 i =0; i < 1; ++i)
+    // Weighted blended OIT doesn't depend on draw order, it only draws the
+    // opaque particles first and on their own.
+    if(renderer.blend_mode == BlendMode::WEIGHTED_OIT)
     {
-        renderer.light_pos[0] = glmath::Vec3(view * glmath::Vec4(renderer.light_pos[0], 1.0f)); 
+        partitionParticlesByOpacity(renderer);
+        renderer.sort_timings.partition_ms = millisecondsSince(sort_start);
+        // A stable partition of only one kind is the order the particles came in.
+        if(renderer.n_opaque_particles > 0 && renderer.n_opaque_particles < renderer.sort_timings.n_particles)
+            applyDrawOrder(renderer);
+        renderer.sort_timings.n_opaque = renderer.n_opaque_particles;
+        renderer.sort_timings.total_ms = millisecondsSince(sort_start);
+        return;
     }
 
-    glUniform3fv(renderer.point_light_uniform, MAX_POINT_LIGHTS, renderer.light_pos[0].data);
-
+    // The GPU sort runs once the particles are uploaded, see sortParticlesOnGpu.
+    if(renderer.sort_mode == SortMode::GPU_BITONIC)
+    {
+        countOpaqueParticles(renderer);
+        renderer.sort_timings.partition_ms = millisecondsSince(sort_start);
+        renderer.sort_timings.n_opaque = renderer.n_opaque_particles;
+        collectGpuSortTime(renderer.gpu_sort);
+        renderer.sort_timings.gpu_sort_ms = renderer.gpu_sort.last_sort_ms;
+        renderer.sort_camera_pos = camera_pos;
+        renderer.gpu_sort_pending = true;
+        renderer.sort_timings.total_ms = millisecondsSince(sort_start);
+        return;
+    }
+
+    if(renderer.sort_mode == SortMode::RADIX || renderer.sort_mode == SortMode::TEMPORAL)
+    {
+        sortParticlesByDepthRadix(renderer, camera_pos);
+    }
+    else
+    {
+        sortParticlesByDepthStd(renderer, camera_pos);
+        renderer.sort_timings.sort_ms = millisecondsSince(sort_start);
+    }
+    renderer.sort_timings.n_opaque = renderer.n_opaque_particles;
+    renderer.sort_timings.total_ms = millisecondsSince(sort_start);
+}
+
+// Whether sortParticlesByDepth makes GL calls, which ties it to the thread the
+// context is current on: the GPU sort reads back its timer, and through the
+// ring sorted particles are staged into a slot that may have to be waited on.
+bool sortUsesGl(const Renderer &renderer)
+{
+    if(renderer.upload_mode == UploadMode::PERSISTENT_RING)
+        return true;
+    return renderer.blend_mode != BlendMode::WEIGHTED_OIT && renderer.sort_mode == SortMode::GPU_BITONIC;
+}
+
+
+
+constexpr i64 INGEST_MIN_BATCH = 1 << 15;
+
+// Grows particle_data by n_particles without initialising the new slots and
+// returns the first of them.
+ParticleData *pushParticles(Renderer &renderer, i64 n_particles)
+{
+    const u64 first = renderer.particle_data.size();
+    renderer.particle_data.resize(first + n_particles);
+    return renderer.particle_data.data() + first;
+}
+
+// Opens a draw group for the particles added next when the radius changed
+// since the last one was opened. Returns the index of the group they go in.
+u32 extendDrawGroups(Renderer &renderer)
+{
+    if(renderer.draw_groups.empty() || renderer.draw_groups.back().radius != renderer.particle_radius)
+        renderer.draw_groups.push_back({particleCount(renderer), renderer.particle_radius});
+    return static_cast<u32>(renderer.draw_groups.size() - 1);
+}
+
+// Reorders the compact particles [begin, end) along a Morton curve over their
+// bounds, so the chunks quantizeParticlePositions cuts from consecutive
+// particles cover small regions and get tight bounds. The range stays where it
+// is, so draw groups keep their particles. The sort scratch and the cull's
+// compaction buffers are free until the frame is culled and sorted.
+void orderParticlesSpatially(Renderer &renderer, i64 begin, i64 end)
+{
+    const i64 count = end - begin;
+    if(count < 2)
+        return;
+    f32 *positions = renderer.compact_positions.data() + begin * 3;
+    u32 *colours = renderer.compact_colours.data() + begin;
+
+    std::vector<f32> batch_bounds(globalThreadPool().threadCount() * 6);
+    for(u64 i = 0; i < batch_bounds.size(); ++i)
+        batch_bounds[i] = i % 6 < 3 ? INFINITY : -INFINITY;
+    parallelFor(count, INGEST_MIN_BATCH, [&](i32 batch, i64 first, i64 last)
+    {
+        positionBounds(positions, first, last, &batch_bounds[batch * 6], &batch_bounds[batch * 6 + 3]);
+    });
+    f32 min[3] = {INFINITY, INFINITY, INFINITY};
+    f32 scale[3];
+    for(i32 axis = 0; axis < 3; ++axis)
+    {
+        f32 max = -INFINITY;
+        for(u64 batch = 0; batch < batch_bounds.size() / 6; ++batch)
+        {
+            min[axis] = std::min(min[axis], batch_bounds[batch * 6 + axis]);
+            max = std::max(max, batch_bounds[batch * 6 + 3 + axis]);
+        }
+        scale[axis] = max > min[axis] ? 1024.0f / (max - min[axis]) : 0.0f;
+    }
+
+    renderer.sort_keys.resize(count);
+    renderer.sort_indices.resize(count);
+    parallelFor(count, INGEST_MIN_BATCH, [&](i32, i64 first, i64 last)
+    {
+        for(i64 i = first; i < last; ++i)
+        {
+            renderer.sort_keys[i] = mortonKey(positions + i * 3, min, scale);
+            renderer.sort_indices[i] = static_cast<u32>(i);
+        }
+    });
+    radixSortKeyIndex(renderer.sort_keys.data(), renderer.sort_indices.data(), count, renderer.radix_scratch);
+
+    renderer.culled_positions.resize(count * 3);
+    renderer.culled_colours.resize(count);
+    parallelFor(count, INGEST_MIN_BATCH, [&](i32, i64 first, i64 last)
+    {
+        for(i64 i = first; i < last; ++i)
+        {
+            const u32 source = renderer.sort_indices[i];
+            memcpy(&renderer.culled_positions[i * 3], positions + source * 3, 3 * sizeof(f32));
+            renderer.culled_colours[i] = colours[source];
+        }
+    });
+    // Usually the frame's only ingest, whose reordered streams can simply be swapped in.
+    if(begin == 0 && end == static_cast<i64>(renderer.compact_colours.size()))
+    {
+        renderer.compact_positions.swap(renderer.culled_positions);
+        renderer.compact_colours.swap(renderer.culled_colours);
+        return;
+    }
+    parallelFor(count, INGEST_MIN_BATCH, [&](i32, i64 first, i64 last)
+    {
+        memcpy(positions + first * 3, &renderer.culled_positions[first * 3], (last - first) * 3 * sizeof(f32));
+        memcpy(colours + first, &renderer.culled_colours[first], (last - first) * sizeof(u32));
+    });
+}
+
+void ingestParticles(Renderer &renderer, const IngestSource &positions, const IngestSource &colours)
+{
+    RENDERER_ASSERT(positions.rows == colours.rows, "Expected one colour per particle (%lld positions, %lld colours).", positions.rows, colours.rows);
+    const f32 group = static_cast<f32>(extendDrawGroups(renderer));
+    if(usesCompactStreams(renderer.particle_layout))
+    {
+        const i64 first = static_cast<i64>(renderer.compact_colours.size());
+        renderer.compact_positions.resize((first + positions.rows) * 3);
+        renderer.compact_colours.resize(first + positions.rows);
+        f32 *position_stream = renderer.compact_positions.data() + first * 3;
+        u32 *colour_stream = renderer.compact_colours.data() + first;
+        parallelFor(positions.rows, INGEST_MIN_BATCH, [&](i32, i64 begin, i64 end)
+        {
+            ingestRows3(position_stream, positions, begin, end);
+            packRowsRGBA8(colour_stream, colours, begin, end);
+        });
+        if(renderer.particle_layout == ParticleLayout::QUANTIZED)
+            orderParticlesSpatially(renderer, first, first + positions.rows);
+        return;
+    }
+
+    ParticleData *particles = pushParticles(renderer, positions.rows);
+    constexpr i64 particle_stride = sizeof(ParticleData) / sizeof(f32);
+    parallelFor(positions.rows, INGEST_MIN_BATCH, [&](i32, i64 begin, i64 end)
+    {
+        ingestRows4(particles->position.data, particle_stride, positions, begin, end, group);
+        ingestRows4(particles->colour.data, particle_stride, colours, begin, end);
+    });
+}
+
+
+
+void renderDebug(const Renderer &renderer)
+{
+    // Assumes that shader program has been bound
+
+    glBindVertexArray(renderer.debug_vao);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, renderer.debug_render_data.offset, renderer.debug_render_data.start); //reupload
+    glLineWidth(2);
+    constexpr i32 nVerts = MAX_DEBUG_AABB * 24 + MAX_DEBUG_LINES * 2;
+    glDrawArrays(GL_LINES, 0 ,nVerts);
+    glBindVertexArray(0);
+}
+
+
+
+// Draw order for the compact layout; identity when nothing sorted this frame.
+const u32 *particleDrawOrder(Renderer &renderer, i64 n_particles)
+{
+    if(!renderer.draw_order_ready)
+    {
+        renderer.sort_indices.resize(n_particles);
+        parallelFor(n_particles, INGEST_MIN_BATCH, [&](i32, i64 begin, i64 end)
+        {
+            for(i64 i = begin; i < end; ++i)
+                renderer.sort_indices[i] = static_cast<u32>(i);
+        });
+        renderer.draw_order_ready = true;
+    }
+    return renderer.sort_indices.data();
+}
+
+void copyParallel(u8 *dst, const void *src, i64 bytes)
+{
+    parallelFor(bytes, INGEST_MIN_BATCH * sizeof(ParticleData), [&](i32, i64 begin, i64 end)
+    {
+        memcpy(dst + begin, static_cast<const u8*>(src) + begin, end - begin);
+    });
+}
+
+// Encodes this frame's positions as 16-bit codes in chunks of
+// QUANTIZED_CHUNK_SIZE particles. A chunk too large to stay within the error
+// tolerance keeps its float positions, gathered into float_chunk_positions, so
+// one spread out chunk doesn't cost the rest of the frame their codes.
+void quantizeParticlePositions(Renderer &renderer, i64 n_particles)
+{
+    const i64 n_chunks = (n_particles + QUANTIZED_CHUNK_SIZE - 1) / QUANTIZED_CHUNK_SIZE;
+    renderer.quantized_positions.resize(n_particles * 3 + 1); // + 1 pads the last word
+    renderer.quantized_chunks.resize(n_chunks);
+    renderer.quantized_positions[n_particles * 3] = 0;
+
+    f32 min_radius = renderer.draw_groups.empty() ? renderer.particle_radius : renderer.draw_groups[0].radius;
+    for(const DrawGroup &group : renderer.draw_groups)
+        min_radius = std::min(min_radius, group.radius);
+    const f32 max_error = renderer.quantization_tolerance * min_radius;
+
+    const f32 *positions = renderer.compact_positions.data();
+    std::vector<f32> batch_errors(globalThreadPool().threadCount(), 0.0f);
+    parallelFor(n_chunks, 64, [&](i32 batch, i64 first_chunk, i64 last_chunk)
+    {
+        for(i64 chunk = first_chunk; chunk < last_chunk; ++chunk)
+        {
+            const i64 begin = chunk * QUANTIZED_CHUNK_SIZE;
+            const i64 end = std::min(n_particles, begin + QUANTIZED_CHUNK_SIZE);
+            QuantizedChunk &bounds = renderer.quantized_chunks[chunk];
+            f32 min[3];
+            f32 max[3];
+            positionBounds(positions, begin, end, min, max);
+            f32 error = quantizedChunkBounds(min, max, bounds);
+            if(error > max_error)
+            {
+                bounds.float_chunk = 0; // numbered below
+                continue;
+            }
+            bounds.float_chunk = QUANTIZED_CODES;
+            batch_errors[batch] = std::max(batch_errors[batch], error);
+            quantizePositions(positions, bounds, begin, end, renderer.quantized_positions.data());
+        }
+    });
+    renderer.quantization_error = *std::max_element(batch_errors.begin(), batch_errors.end());
+
+    u32 n_float_chunks = 0;
+    for(QuantizedChunk &chunk : renderer.quantized_chunks)
+    {
+        if(chunk.float_chunk != QUANTIZED_CODES)
+            chunk.float_chunk = n_float_chunks++;
+    }
+    renderer.float_chunk_positions.resize(static_cast<i64>(n_float_chunks) * QUANTIZED_CHUNK_SIZE * 3);
+    if(n_float_chunks == 0)
+        return;
+    parallelFor(n_chunks, 64, [&](i32, i64 first_chunk, i64 last_chunk)
+    {
+        for(i64 chunk = first_chunk; chunk < last_chunk; ++chunk)
+        {
+            const u32 float_chunk = renderer.quantized_chunks[chunk].float_chunk;
+            if(float_chunk == QUANTIZED_CODES)
+                continue;
+            const i64 begin = chunk * QUANTIZED_CHUNK_SIZE;
+            const i64 end = std::min(n_particles, begin + QUANTIZED_CHUNK_SIZE);
+            memcpy(&renderer.float_chunk_positions[static_cast<i64>(float_chunk) * QUANTIZED_CHUNK_SIZE * 3], positions + begin * 3, (end - begin) * 3 * sizeof(f32));
+        }
+    });
+}
+
+// Every radius of the frame goes in one small table the vertex shader looks
+// particles up in, so mixed sizes still draw in depth order with one call. The
+// table is a buffer rather than uniforms so any number of groups fits. It is
+// uploaded once a frame with the particles, only when the groups changed, into
+// a buffer that only ever grows.
+void uploadDrawGroups(Renderer &renderer)
+{
+    const i64 n_groups = static_cast<i64>(renderer.draw_groups.size());
+    bool changed = static_cast<i64>(renderer.gpu_draw_groups.size()) != n_groups;
+    for(i64 i = 0; i < n_groups && !changed; ++i)
+        changed = renderer.gpu_draw_groups[i].first != renderer.draw_groups[i].first || renderer.gpu_draw_groups[i].radius != renderer.draw_groups[i].radius;
+    if(!changed)
+        return;
+
+    renderer.gpu_draw_groups.resize(n_groups);
+    for(i64 i = 0; i < n_groups; ++i)
+        renderer.gpu_draw_groups[i] = {static_cast<u32>(renderer.draw_groups[i].first), renderer.draw_groups[i].radius};
+    const i64 bytes = n_groups * sizeof(GpuDrawGroup);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer.draw_group_buffer);
+    if(renderer.draw_group_capacity_bytes < bytes)
+    {
+        i64 new_size_bytes = std::max(bytes, renderer.draw_group_capacity_bytes * 2);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, new_size_bytes, nullptr, GL_DYNAMIC_DRAW);
+        renderer.draw_group_capacity_bytes = new_size_bytes;
+    }
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, renderer.gpu_draw_groups.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// Uploads the frame's streams and binds them. Without with_draw_order the
+// caller binds a draw order of its own for the compact layouts.
+void uploadParticleStreams(Renderer &renderer, i64 n_particles, bool with_draw_order)
+{
+    const ParticleLayout layout = renderer.particle_layout;
+    if(layout == ParticleLayout::QUANTIZED)
+        quantizeParticlePositions(renderer, n_particles);
+
+    const u32 *draw_order = usesCompactStreams(layout) && with_draw_order ? particleDrawOrder(renderer, n_particles) : nullptr;
+    const ParticleStreams streams = particleStreams(renderer, layout, n_particles, draw_order);
+
+    u32 buffer;
+    i64 base;
+    if(renderer.upload_mode == UploadMode::PERSISTENT_RING)
+    {
+        // A staged slot already holds the interleaved particles written by the sort.
+        if(!renderer.staged_slot)
+        {
+            u8 *slot = acquireRingSlot(renderer.particle_ring, streams.total_bytes, renderer.ssbo_offset_alignment);
+            for(i32 i = 0; i < streams.n_streams; ++i)
+                copyParallel(slot + streams.streams[i].offset, streams.streams[i].data, streams.streams[i].bytes);
+        }
+        buffer = renderer.particle_ring.buffer;
+        base = renderer.particle_ring.slot * renderer.particle_ring.slot_stride_bytes;
+    }
+    else
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER,renderer.dynamic_sso);
+        if(renderer.dynamic_sso_capacity_bytes < streams.total_bytes)
+        {
+            i64 new_size_bytes = std::max(streams.total_bytes, renderer.dynamic_sso_capacity_bytes + renderer.dynamic_sso_capacity_bytes / 2);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, new_size_bytes, nullptr,GL_DYNAMIC_DRAW);
+            renderer.dynamic_sso_capacity_bytes = new_size_bytes;
+        }
+        for(i32 i = 0; i < streams.n_streams; ++i)
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, streams.streams[i].offset, streams.streams[i].bytes, streams.streams[i].data);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER,0);
+        buffer = renderer.dynamic_sso;
+        base = 0;
+    }
+
+    for(i32 i = 0; i < streams.n_streams; ++i)
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, streams.streams[i].binding, buffer, base + streams.streams[i].offset, streams.streams[i].bytes);
+    uploadDrawGroups(renderer);
+}
+
+// Orders the uploaded particles back to front entirely on the GPU: one pass
+// writes a depth key per particle, then a bitonic sort over a power of two
+// slots runs whole merges inside shared memory blocks and only the wide compare
+// distances as separate global passes. The sorted indices are bound as the draw order.
+void sortParticlesOnGpu(Renderer &renderer, ParticleLayout layout, i64 n_particles)
+{
+    GpuSort &sort = renderer.gpu_sort;
+    i64 n_slots = GPU_SORT_BLOCK_SIZE;
+    while(n_slots < n_particles)
+        n_slots <<= 1;
+    const i64 n_groups = n_slots / GPU_SORT_BLOCK_SIZE;
+    RENDERER_ASSERT(n_slots / GPU_SORT_GROUP_SIZE <= 65535, "Too many particles for the GPU sort (%lld).", n_particles);
+
+    const i64 slot_bytes = n_slots * sizeof(u32);
+    const i64 index_offset = (slot_bytes + renderer.ssbo_offset_alignment - 1) / renderer.ssbo_offset_alignment * renderer.ssbo_offset_alignment;
+    if(sort.capacity_bytes < index_offset + slot_bytes)
+    {
+        sort.capacity_bytes = index_offset + slot_bytes;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, sort.buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sort.capacity_bytes, nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, SORT_KEY_BINDING, sort.buffer, 0, slot_bytes);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, DRAW_ORDER_BINDING, sort.buffer, index_offset, slot_bytes);
+
+    // Only one timer is in flight, frames sorted while it is pending go untimed.
+    const bool timed = !sort.timer_pending;
+    if(timed)
+        glBeginQuery(GL_TIME_ELAPSED, sort.timer_query);
+
+    glUseProgram(sort.program);
+    glUniform1ui(sort.particle_layout_uniform, static_cast<u32>(layout));
+    glUniform1ui(sort.n_particles_uniform, static_cast<u32>(n_particles));
+    glUniform3fv(sort.camera_pos_uniform, 1, renderer.sort_camera_pos.data);
+    auto dispatch = [&](GpuSortStage stage, i64 groups)
+    {
+        glUniform1ui(sort.stage_uniform, static_cast<u32>(stage));
+        glDispatchCompute(static_cast<u32>(groups), 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    };
+
+    dispatch(GpuSortStage::GENERATE_KEYS, n_slots / GPU_SORT_GROUP_SIZE);
+    dispatch(GpuSortStage::SORT_BLOCKS, n_groups);
+    for(i64 merge_size = GPU_SORT_BLOCK_SIZE * 2; merge_size <= n_slots; merge_size <<= 1)
+    {
+        glUniform1ui(sort.merge_size_uniform, static_cast<u32>(merge_size));
+        for(i64 distance = merge_size / 2; distance >= GPU_SORT_BLOCK_SIZE; distance >>= 1)
+        {
+            glUniform1ui(sort.compare_distance_uniform, static_cast<u32>(distance));
+            dispatch(GpuSortStage::MERGE_GLOBAL, n_groups);
+        }
+        dispatch(GpuSortStage::MERGE_BLOCKS, n_groups);
+    }
+
+    if(timed)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        sort.timer_pending = true;
+    }
+    glUseProgram(renderer.shader_program);
+}
+
+// Draws the bound particle streams. With through_draw_order the interleaved
+// layout reads its particles through the bound draw order as well.
+void drawParticles(Renderer &renderer, ParticleLayout layout, i64 n_particles, bool through_draw_order)
+{
+    glUniform1ui(renderer.render_mode_uniform, 1);
+    glUniform1ui(renderer.particle_layout_uniform, static_cast<u32>(layout));
+    glUniform1ui(renderer.gpu_sorted_uniform, through_draw_order);
+    glUniform1ui(renderer.quad_path_uniform, static_cast<u32>(renderer.quad_path));
+    glUniform1ui(renderer.sphere_mode_uniform, static_cast<u32>(renderer.sphere_mode));
+    glUniform1ui(renderer.count_fragments_uniform, renderer.count_fragments);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_GROUP_BINDING, renderer.draw_group_buffer);
+    glUniform1ui(renderer.n_draw_groups_uniform, static_cast<u32>(renderer.gpu_draw_groups.size()));
+    auto drawRange = [&](i64 first, i64 count)
+    {
+        if(renderer.sphere_mode == SphereMode::MESH)
+        {
+            glUniform1ui(renderer.first_particle_uniform, static_cast<u32>(first));
+            glDrawElementsInstanced(GL_TRIANGLES, renderer.n_sphere_mesh_indices, GL_UNSIGNED_SHORT, nullptr, static_cast<GLsizei>(count));
+        }
+        else if(renderer.quad_path == QuadPath::INSTANCED_STRIP)
+        {
+            glUniform1ui(renderer.first_particle_uniform, static_cast<u32>(first));
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(count));
+        }
+        else
+        {
+            glDrawArrays(GL_TRIANGLES, 6 * first, 6 * count);
+        }
+    };
+
+    // Opaque particles first with depth writes and no blending, so hidden
+    // fragments of everything drawn after them fail the depth test. The sorted
+    // translucent tail is then blended on top without writing depth.
+    const i64 n_opaque = renderer.n_opaque_particles;
+    if(renderer.blend_mode == BlendMode::WEIGHTED_OIT)
+    {
+        // The opaque particles go straight into the target, the translucent
+        // ones are accumulated against their depth, see renderParticlesWeightedOit.
+        const OitTargets &oit = renderer.oit_targets;
+        GLint target_framebuffer;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target_framebuffer);
+        glUniform1ui(renderer.blend_mode_uniform, static_cast<u32>(BlendMode::SORTED));
+        glDisable(GL_BLEND);
+        if(n_opaque > 0)
+            drawRange(0, n_opaque);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, oit.framebuffer);
+        if(n_opaque > 0 && !oit.shared_depth)
+        {
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            drawRange(0, n_opaque);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        }
+        glEnable(GL_BLEND);
+        glBlendFunci(0, GL_ONE, GL_ONE);
+        glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+        glUniform1ui(renderer.blend_mode_uniform, static_cast<u32>(BlendMode::WEIGHTED_OIT));
+        if(n_opaque < n_particles)
+        {
+            glDepthMask(GL_FALSE);
+            drawRange(n_opaque, n_particles - n_opaque);
+            glDepthMask(GL_TRUE);
+        }
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_framebuffer);
+        return;
+    }
+    if(n_opaque > 0)
+    {
+        glDisable(GL_BLEND);
+        drawRange(0, n_opaque);
+        glEnable(GL_BLEND);
+    }
+    if(n_opaque < n_particles)
+    {
+        glDepthMask(GL_FALSE);
+        drawRange(n_opaque, n_particles - n_opaque);
+        glDepthMask(GL_TRUE);
+    }
+}
+
+void uploadAndRenderParticles(Renderer & renderer)
+{
+    const i64 n_particles = particleCount(renderer);
+    if(n_particles == 0)
+    {
+        clearParticles(renderer);
+        return;
+    }
+    beginGpuPass(renderer.gpu_profiler, GpuPass::UPLOAD);
+    const ParticleLayout layout = renderer.particle_layout;
+    uploadParticleStreams(renderer, n_particles, !renderer.gpu_sort_pending);
+    endGpuPass(renderer.gpu_profiler, GpuPass::UPLOAD);
+    // The GPU sort keeps its own timer, which can't overlap the pass timers.
+    if(renderer.gpu_sort_pending)
+        sortParticlesOnGpu(renderer, layout, n_particles);
+
+
+    beginGpuPass(renderer.gpu_profiler, GpuPass::DRAW);
+    drawParticles(renderer, layout, n_particles, renderer.gpu_sort_pending);
+    endGpuPass(renderer.gpu_profiler, GpuPass::DRAW);
+
+    if(renderer.upload_mode == UploadMode::PERSISTENT_RING)
+        releaseRingSlot(renderer.particle_ring);
+
+    clearParticles(renderer);
+}
+
+void destroyOitTargets(OitTargets &targets)
+{
+    if(targets.framebuffer == 0)
+        return;
+    glDeleteFramebuffers(1, &targets.framebuffer);
+    glDeleteTextures(1, &targets.accumulation);
+    glDeleteTextures(1, &targets.revealage);
+    glDeleteRenderbuffers(1, &targets.depth);
+    targets = {};
+}
+
+// (Re)creates the OIT targets whenever the viewport size changes.
+void resizeOitTargets(OitTargets &targets, i32 width, i32 height)
+{
+    if(targets.framebuffer != 0 && targets.width == width && targets.height == height)
+        return;
+    destroyOitTargets(targets);
+    targets.width = width;
+    targets.height = height;
+
+    auto createTarget = [&](GLenum internal_format, GLenum format, GLenum type)
+    {
+        u32 texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return texture;
+    };
+    targets.accumulation = createTarget(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT);
+    targets.revealage = createTarget(GL_R8, GL_RED, GL_UNSIGNED_BYTE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenRenderbuffers(1, &targets.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, targets.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    GLint previous_framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_framebuffer);
+    glGenFramebuffers(1, &targets.framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targets.framebuffer);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targets.accumulation, 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, targets.revealage, 0);
+    const GLenum draw_buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, draw_buffers);
+    GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+    RENDERER_ASSERT(status == GL_FRAMEBUFFER_COMPLETE, "OIT framebuffer is incomplete (0x%x).", status);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previous_framebuffer);
+}
+
+// Attaches the depth of the bound target to the OIT framebuffer when it is a
+// single sample attachment; the renderer's depth textures are the view layers.
+// The default framebuffer's and multisampled depth can't be attached, so the
+// OIT targets clear their own depth instead.
+void shareOitDepth(OitTargets &targets)
+{
+    GLint target_framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target_framebuffer);
+    GLint samples = 0;
+    glGetIntegerv(GL_SAMPLES, &samples);
+    GLint type = GL_NONE;
+    GLint name = 0;
+    GLint layer = 0;
+    if(target_framebuffer != 0 && samples <= 1)
+    {
+        glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+        if(type != GL_NONE)
+            glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &name);
+        if(type == GL_TEXTURE)
+            glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_LAYER, &layer);
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targets.framebuffer);
+    targets.shared_depth = type == GL_RENDERBUFFER || type == GL_TEXTURE;
+    if(type == GL_TEXTURE)
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, name, 0, layer);
+    else
+        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, targets.shared_depth ? name : targets.depth);
+    if(!targets.shared_depth)
+    {
+        const f32 clear_depth = 1.0f;
+        glClearBufferfv(GL_DEPTH, 0, &clear_depth);
+    }
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_framebuffer);
+}
+
+// Weighted blended OIT (McGuire and Bavoil 2013). draw_particles draws the
+// opaque particles into the bound framebuffer and accumulates the translucent
+// ones unsorted into the OIT targets, depth tested against the opaque ones, see
+// drawParticles. One fullscreen triangle then resolves them over the target.
+template <typename F>
+void renderParticlesWeightedOit(Renderer &renderer, F &&draw_particles)
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    resizeOitTargets(renderer.oit_targets, viewport[0] + viewport[2], viewport[1] + viewport[3]);
+    shareOitDepth(renderer.oit_targets);
+
+    GLint target_framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target_framebuffer);
+    const bool depth_test = glIsEnabled(GL_DEPTH_TEST);
+    const bool cull_face = glIsEnabled(GL_CULL_FACE);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, renderer.oit_targets.framebuffer);
+    const f32 clear_accumulation[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    const f32 clear_revealage[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    glClearBufferfv(GL_COLOR, 0, clear_accumulation);
+    glClearBufferfv(GL_COLOR, 1, clear_revealage);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_framebuffer);
+
+    draw_particles();
+
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, renderer.oit_targets.accumulation);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, renderer.oit_targets.revealage);
+    glUniform1ui(renderer.render_mode_uniform, 2);
+    beginGpuPass(renderer.gpu_profiler, GpuPass::COMPOSITE);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    endGpuPass(renderer.gpu_profiler, GpuPass::COMPOSITE);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    if(depth_test) glEnable(GL_DEPTH_TEST);
+    if(cull_face) glEnable(GL_CULL_FACE);
+}
+
+// The view matrix and the light, which is given in world space and lit in view
+// space. The billboard basis is the camera's right and up axes in world space,
+// the first two rows of the view's rotation, which assumes a rigid view as
+// lookAt builds.
+void setViewUniforms(Renderer &renderer, const glmath::Mat4x4 &view, const glmath::Mat4x4 &projection)
+{
+    glUniformMatrix4fv(renderer.view_uniform, 1, false, view.data[0]);
+    const glmath::Mat4x4 view_projection = projection * view;
+    glUniformMatrix4fv(renderer.view_projection_uniform, 1, false, view_projection.data[0]);
+    const glmath::Vec3 right = {view.data[0][0], view.data[1][0], view.data[2][0]};
+    const glmath::Vec3 up = {view.data[0][1], view.data[1][1], view.data[2][1]};
+    glUniform3fv(renderer.billboard_right_uniform, 1, right.data);
+    glUniform3fv(renderer.billboard_up_uniform, 1, up.data);
+
+    renderer.light_pos[0] = glmath::Vec3(3.0, 3.0, 3.0);
+
+
+
+    for(i32 i =0; i < 1; ++i)
+    {
+        renderer.light_pos[0] = glmath::Vec3(view * glmath::Vec4(renderer.light_pos[0], 1.0f)); 
+    }
+
+    glUniform3fv(renderer.point_light_uniform, MAX_POINT_LIGHTS, renderer.light_pos[0].data);
+}
+
+GLenum colourInternalFormat(ColourFormat format)
+{
+    switch(format)
+    {
+        case ColourFormat::RGB10_A2: return GL_RGB10_A2;
+        case ColourFormat::RGBA16F: return GL_RGBA16F;
+        default: return GL_RGBA8;
+    }
+}
+
+GLenum depthInternalFormat(DepthFormat format)
+{
+    switch(format)
+    {
+        case DepthFormat::DEPTH16: return GL_DEPTH_COMPONENT16;
+        case DepthFormat::DEPTH32F: return GL_DEPTH_COMPONENT32F;
+        default: return GL_DEPTH_COMPONENT24;
+    }
+}
+
+void destroyRenderTarget(RenderTarget &target)
+{
+    if(target.framebuffer == 0)
+        return;
+    glDeleteFramebuffers(1, &target.framebuffer);
+    glDeleteRenderbuffers(1, &target.colour);
+    glDeleteRenderbuffers(1, &target.depth);
+    if(target.resolve_framebuffer != 0)
+    {
+        glDeleteFramebuffers(1, &target.resolve_framebuffer);
+        glDeleteRenderbuffers(1, &target.resolve_colour);
+    }
+    target = {};
+}
+
+// (Re)creates the target when its size, sample count or formats change, so
+// frames of the same configuration reuse the attachments. samples is clamped
+// to what the implementation supports.
+void resizeRenderTarget(RenderTarget &target, i32 width, i32 height, i32 samples, ColourFormat colour_format, DepthFormat depth_format)
+{
+    RENDERER_ASSERT(width > 0 && height > 0, "Expected a positive resolution, got %d x %d.", width, height);
+    GLint max_samples;
+    glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+    samples = std::clamp(samples, 1, std::max(1, max_samples));
+    if(target.framebuffer != 0 && target.width == width && target.height == height && target.samples == samples &&
+       target.colour_format == colour_format && target.depth_format == depth_format)
+        return;
+    destroyRenderTarget(target);
+    target.width = width;
+    target.height = height;
+    target.samples = samples;
+    target.colour_format = colour_format;
+    target.depth_format = depth_format;
+
+    auto createAttachment = [&](GLenum internal_format, i32 n_samples)
+    {
+        u32 renderbuffer;
+        glGenRenderbuffers(1, &renderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+        if(n_samples > 1)
+            glRenderbufferStorageMultisample(GL_RENDERBUFFER, n_samples, internal_format, width, height);
+        else
+            glRenderbufferStorage(GL_RENDERBUFFER, internal_format, width, height);
+        return renderbuffer;
+    };
+    auto createFramebuffer = [&](u32 colour, u32 depth)
+    {
+        u32 framebuffer;
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colour);
+        if(depth != 0)
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        RENDERER_ASSERT(status == GL_FRAMEBUFFER_COMPLETE, "Render target framebuffer is incomplete (0x%x).", status);
+        return framebuffer;
+    };
+
+    GLint previous_framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_framebuffer);
+    target.colour = createAttachment(colourInternalFormat(colour_format), samples);
+    target.depth = createAttachment(depthInternalFormat(depth_format), samples);
+    target.framebuffer = createFramebuffer(target.colour, target.depth);
+    if(samples > 1)
+    {
+        target.resolve_colour = createAttachment(colourInternalFormat(colour_format), 1);
+        target.resolve_framebuffer = createFramebuffer(target.resolve_colour, 0);
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+}
+
+// Makes the target the draw framebuffer covering the whole viewport.
+void bindRenderTarget(const RenderTarget &target)
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target.framebuffer);
+    glViewport(0, 0, target.width, target.height);
+}
+
+// Resolves a multisampled frame and binds the single sample colour as the read
+// framebuffer, where readbacks take the frame from.
+void resolveRenderTarget(const RenderTarget &target)
+{
+    if(target.samples > 1)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, target.framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target.resolve_framebuffer);
+        glBlitFramebuffer(0, 0, target.width, target.height, 0, 0, target.width, target.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target.framebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, target.resolve_framebuffer);
+        return;
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, target.framebuffer);
+}
+
+void destroyViewTargets(ViewTargets &targets)
+{
+    if(targets.framebuffer == 0)
+        return;
+    glDeleteFramebuffers(1, &targets.framebuffer);
+    glDeleteTextures(1, &targets.colour);
+    glDeleteTextures(1, &targets.depth);
+    glDeleteBuffers(1, &targets.draw_order_buffer);
+    targets = {};
+}
+
+// (Re)creates the view layers whenever their size or count changes.
+void resizeViewTargets(ViewTargets &targets, i32 width, i32 height, i32 n_layers)
+{
+    if(targets.framebuffer != 0 && targets.width == width && targets.height == height && targets.n_layers == n_layers)
+        return;
+    GLint max_layers;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+    RENDERER_ASSERT(n_layers > 0 && n_layers <= max_layers, "Expected between 1 and %d views, got %d.", max_layers, n_layers);
+    destroyViewTargets(targets);
+    targets.width = width;
+    targets.height = height;
+    targets.n_layers = n_layers;
+
+    auto createLayers = [&](GLenum internal_format)
+    {
+        u32 texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, internal_format, width, height, n_layers);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return texture;
+    };
+    targets.colour = createLayers(GL_RGBA8);
+    targets.depth = createLayers(GL_DEPTH_COMPONENT24);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glGenFramebuffers(1, &targets.framebuffer);
+    glGenBuffers(1, &targets.draw_order_buffer);
+}
+
+// Counting makes every fragment do an atomic add, so it is for measuring only.
+void setFragmentCounting(Renderer &renderer, bool enabled)
+{
+    if(enabled && renderer.fragment_count_buffer == 0)
+    {
+        glGenBuffers(1, &renderer.fragment_count_buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer.fragment_count_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(u32), nullptr, GL_DYNAMIC_READ);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FRAGMENT_COUNT_BINDING, renderer.fragment_count_buffer);
+    }
+    renderer.count_fragments = enabled;
+}
+
+void resetFragmentCounts(Renderer &renderer)
+{
+    if(!renderer.count_fragments)
+        return;
+    const u32 zeros[2] = {0, 0};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer.fragment_count_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeros), zeros);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// Waits for the last frame's draws; -1 when counting was never enabled.
+FragmentCounts readFragmentCounts(const Renderer &renderer)
+{
+    if(renderer.fragment_count_buffer == 0)
+        return {-1, -1};
+    u32 counts[2];
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer.fragment_count_buffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counts), counts);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return {counts[0], counts[1]};
+}
+
+// Draws the current particles once per camera, each into its own layer of the
+// view targets. The particles are uploaded once in their original order and
+// every view draws them through its own draw order, which is all that is
+// culled, sorted and uploaded per view. Each view keeps only the particles in
+// its frustum and sorts them in the renderer's sort mode; TEMPORAL repairs the
+// order of the view before, which stays close for nearby cameras. The GPU sort
+// orders every uploaded particle, so its views aren't culled. Without culling,
+// weighted OIT shares one opacity partition between all views and a view from
+// the same position as the one before it reuses its order.
+void renderViews(Renderer &renderer, std::span<const ViewCamera> cameras, const glmath::Mat4x4 &projection, i32 width, i32 height)
+{
+    // The profiler times single view frames; batches of views go untimed.
+    closeGpuFrame(renderer.gpu_profiler);
+    resetFragmentCounts(renderer);
+    ViewTargets &targets = renderer.view_targets;
+    resizeViewTargets(targets, width, height, static_cast<i32>(cameras.size()));
+
+    GLint previous_framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_framebuffer);
+    GLint previous_viewport[4];
+    glGetIntegerv(GL_VIEWPORT, previous_viewport);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targets.framebuffer);
+    glViewport(0, 0, width, height);
+
+    const auto sort_start = std::chrono::steady_clock::now();
+    renderer.sort_timings = {};
+    const i64 n_particles = particleCount(renderer);
+    renderer.sort_timings.n_particles = n_particles;
+    renderer.cull_stats = {};
+
+    useParticleProgram(renderer);
+    glUniformMatrix4fv(renderer.projection_uniform, 1, false, projection.data[0]);
+    glBindVertexArray(renderer.dummy_vao);
+    const ParticleLayout layout = renderer.particle_layout;
+    if(n_particles > 0)
+        uploadParticleStreams(renderer, n_particles, false);
+
+    auto uploadDrawOrder = [&]
+    {
+        const i64 n_drawn = static_cast<i64>(renderer.sort_indices.size());
+        if(n_drawn == 0)
+            return;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, targets.draw_order_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, n_drawn * sizeof(u32), renderer.sort_indices.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, DRAW_ORDER_BINDING, targets.draw_order_buffer, 0, n_drawn * sizeof(u32));
+    };
+    const bool sorted = renderer.blend_mode == BlendMode::SORTED;
+    const bool gpu_sorted = sorted && renderer.sort_mode == SortMode::GPU_BITONIC;
+    const bool cull_views = renderer.frustum_culling && !gpu_sorted;
+    // Unculled weighted OIT draws every view in the same order, opaque particles first.
+    if(n_particles > 0 && !sorted && !cull_views)
+    {
+        partitionParticlesByOpacity(renderer);
+        uploadDrawOrder();
+    }
+    else if(n_particles > 0 && gpu_sorted)
+    {
+        countOpaqueParticles(renderer);
+    }
+
+    for(u64 v = 0; v < cameras.size(); ++v)
+    {
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, targets.colour, 0, static_cast<i32>(v));
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, targets.depth, 0, static_cast<i32>(v));
+        if(v == 0)
+        {
+            GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+            RENDERER_ASSERT(status == GL_FRAMEBUFFER_COMPLETE, "View framebuffer is incomplete (0x%x).", status);
+        }
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        setViewUniforms(renderer, cameras[v].view, projection);
+        if(n_particles == 0)
+            continue;
+
+        const bool same_position = v > 0 && cameras[v].pos.x == cameras[v - 1].pos.x && cameras[v].pos.y == cameras[v - 1].pos.y && cameras[v].pos.z == cameras[v - 1].pos.z;
+        const bool reuse_order = same_position && !cull_views;
+        if(cull_views)
+        {
+            const auto cull_start = std::chrono::steady_clock::now();
+            markVisibleParticles(renderer, projection * cameras[v].view);
+            partitionVisibleParticlesByOpacity(renderer);
+            renderer.cull_stats.cull_ms += millisecondsSince(cull_start);
+        }
+        else if(sorted && !gpu_sorted && !reuse_order)
+        {
+            const auto stage_start = std::chrono::steady_clock::now();
+            partitionParticlesByOpacity(renderer);
+            renderer.sort_timings.partition_ms += millisecondsSince(stage_start);
+        }
+        const i64 n_drawn = gpu_sorted ? n_particles : static_cast<i64>(renderer.sort_indices.size());
+        renderer.cull_stats.n_visible += n_drawn;
+        renderer.cull_stats.n_culled += n_particles - n_drawn;
+
+        if(!sorted)
+        {
+            if(cull_views)
+                uploadDrawOrder();
+            if(n_drawn > 0)
+                renderParticlesWeightedOit(renderer, [&]{ drawParticles(renderer, layout, n_drawn, true); });
+            continue;
+        }
+
+        glUniform1ui(renderer.blend_mode_uniform, static_cast<u32>(BlendMode::SORTED));
+        if(gpu_sorted)
+        {
+            if(!same_position)
+            {
+                renderer.sort_camera_pos = cameras[v].pos;
+                sortParticlesOnGpu(renderer, layout, n_particles);
+            }
+        }
+        else if(!reuse_order)
+        {
+            if(renderer.sort_mode == SortMode::STD_SORT)
+                sortTranslucentStd(renderer, cameras[v].pos);
+            else if(renderer.sort_mode == SortMode::TEMPORAL)
+                sortTranslucentTemporal(renderer, cameras[v].pos);
+            else
+                sortTranslucentRadix(renderer, cameras[v].pos);
+            uploadDrawOrder();
+        }
+        if(n_drawn > 0)
+            drawParticles(renderer, layout, n_drawn, true);
+    }
+    renderer.sort_timings.n_opaque = renderer.n_opaque_particles;
+    renderer.sort_timings.total_ms = millisecondsSince(sort_start);
+
+    glBindVertexArray(0);
+    if(n_particles > 0 && renderer.upload_mode == UploadMode::PERSISTENT_RING)
+        releaseRingSlot(renderer.particle_ring);
+    clearParticles(renderer);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previous_framebuffer);
+    glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2], previous_viewport[3]);
+}
+
+void renderScene(Renderer & renderer, const glmath::Mat4x4 &view, const glmath::Mat4x4 &projection)
+{
+    // RENDERER_ASSERT(glXGetCurrentContext() != nullptr, "Called on thread without a valid context.");
+
+    beginGpuFrame(renderer.gpu_profiler);
+    resetFragmentCounts(renderer);
+    beginGpuPass(renderer.gpu_profiler, GpuPass::CLEAR);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    endGpuPass(renderer.gpu_profiler, GpuPass::CLEAR);
+    useParticleProgram(renderer);
+    glUniformMatrix4fv(renderer.projection_uniform, 1, false, projection.data[0]);
+    setViewUniforms(renderer, view, projection);
 
 
     glBindVertexArray(renderer.dummy_vao);
@@ -475,7 +1973,18 @@ void renderScene(Renderer & renderer, const glmath::Mat4x4 &view, const glmath::
     // glDrawArrays(GL_TRIANGLES,0,6);
 
 
-    uploadAndRenderParticles(renderer);
+    if(renderer.blend_mode == BlendMode::WEIGHTED_OIT)
+    {
+        if(particleCount(renderer) > 0)
+            renderParticlesWeightedOit(renderer, [&]{ uploadAndRenderParticles(renderer); });
+        else
+            clearParticles(renderer);
+    }
+    else
+    {
+        glUniform1ui(renderer.blend_mode_uniform, static_cast<u32>(BlendMode::SORTED));
+        uploadAndRenderParticles(renderer);
+    }
     glBindVertexArray(0);
 
     // glUniform1ui(renderer.render_mode_uniform,0);
@@ -484,9 +1993,100 @@ void renderScene(Renderer & renderer, const glmath::Mat4x4 &view, const glmath::
     // renderDebug(renderer);
 }
 
-void setRadius(const Renderer &renderer, f32 radius)
+// Starts an asynchronous RGB readback of the bound read framebuffer into the
+// next free slot. Collect the oldest one first when the ring is full.
+void issueReadback(ReadbackRing &ring, i32 width, i32 height)
+{
+    RENDERER_ASSERT(ring.n_pending < static_cast<i32>(ring.slots.size()), "Readback ring is full, collect a frame first.");
+    ReadbackSlot &slot = ring.slots[(ring.oldest + ring.n_pending) % ring.slots.size()];
+    const i64 bytes = static_cast<i64>(width) * height * 3;
+
+    if(slot.buffer == 0)
+        glGenBuffers(1, &slot.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    if(slot.capacity_bytes < bytes)
+    {
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+        slot.capacity_bytes = bytes;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    slot.width = width;
+    slot.height = height;
+    ++ring.n_pending;
+}
+
+const ReadbackSlot &oldestReadback(const ReadbackRing &ring)
+{
+    RENDERER_ASSERT(ring.n_pending > 0, "No readback in flight.");
+    return ring.slots[ring.oldest];
+}
+
+// Waits for the oldest readback and copies it to pixels as tightly packed RGB
+// rows, top row first when flip is set and in GL's bottom-up order otherwise.
+void collectReadback(ReadbackRing &ring, u8 *pixels, bool flip)
+{
+    RENDERER_ASSERT(ring.n_pending > 0, "No readback in flight.");
+    ReadbackSlot &slot = ring.slots[ring.oldest];
+    const i64 row_bytes = static_cast<i64>(slot.width) * 3;
+    const i64 bytes = row_bytes * slot.height;
+
+    glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const u8 *mapped = static_cast<const u8*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT));
+    RENDERER_ASSERT(mapped != nullptr, "Failed to map the readback buffer.");
+    if(flip)
+    {
+        for(i64 row = 0; row < slot.height; ++row)
+            memcpy(pixels + row * row_bytes, mapped + (slot.height - 1 - row) * row_bytes, row_bytes);
+    }
+    else
+    {
+        memcpy(pixels, mapped, bytes);
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    ring.oldest = (ring.oldest + 1) % ring.slots.size();
+    --ring.n_pending;
+}
+
+// Reads the bound read framebuffer synchronously into pixels as tightly packed
+// RGB rows, top row first when flip is set.
+void readPixelsRGB(i32 width, i32 height, u8 *pixels, bool flip, std::vector<u8> &row_scratch)
+{
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    if(flip)
+        flipRowsInPlace(pixels, static_cast<i64>(width) * 3, height, row_scratch);
+}
+
+// Reads every layer of the view targets in one transfer into pixels as
+// (layer, row, column, RGB), with each layer's top row first when flip is set.
+void readViewsRGB(const ViewTargets &targets, u8 *pixels, bool flip, std::vector<u8> &row_scratch)
+{
+    glBindTexture(GL_TEXTURE_2D_ARRAY, targets.colour);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    if(!flip)
+        return;
+    const i64 row_bytes = static_cast<i64>(targets.width) * 3;
+    for(i32 layer = 0; layer < targets.n_layers; ++layer)
+        flipRowsInPlace(pixels + layer * row_bytes * targets.height, row_bytes, targets.height, row_scratch);
+}
+
+// Radius of the particles ingested after this call; earlier ones keep theirs.
+void setRadius(Renderer &renderer, f32 radius)
 {
-    glUniform1f(renderer.particle_radius_uniform, radius);
+    renderer.particle_radius = radius;
 }
 
 
@@ -0,0 +1,493 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <string>
+#include <chrono>
+#include <span>
+#include <array>
+#include <vector>
+
+#include "external/glad/glad.h"
+
+#include "defintions.h"
+#include "utility.h"
+#include "glmath.h"
+#include "sort.h"
+#include "ingest.h"
+#include "quantize.h"
+#include "gpu_profiler.h"
+
+
+struct Line
+{
+    glmath::Vec3 points[2];
+    Line(glmath::Vec3 p1, glmath::Vec3 p2)
+    {
+        points[0] = p1;
+        points[1] = p2;
+    }
+    Line()
+    {
+        points[0] = {0.0,0.0,0.0};
+        points[1] = {0.0,0.0,0.0};
+    }
+
+};
+struct DebugAABB
+{
+    glmath::Vec3 verts[24];
+   
+
+    DebugAABB(glmath::Vec3 bl, glmath::Vec3 tr)
+    {
+        f32 width  = tr.x - bl.x;
+        f32 height = tr.y - bl.y;
+        f32 depth  = tr.z - bl.z;
+
+        // bottom
+        verts[0] = {bl.x, bl.y , bl.z};
+        verts[1] = {bl.x + width, bl.y, bl.z};
+
+        verts[2] = {bl.x + width, bl.y, bl.z};
+        verts[3] = {bl.x + width, bl.y, bl.z + depth};
+
+        verts[4] = {bl.x + width, bl.y, bl.z + depth};
+        verts[5] = {bl.x, bl.y, bl.z + depth};
+
+        verts[6] = {bl.x, bl.y , bl.z};
+        verts[7] = {bl.x, bl.y, bl.z + depth};
+
+        //top 
+        verts[8] = {bl.x, bl.y + height , bl.z} ;
+        verts[9] = {bl.x + width, bl.y + height, bl.z};
+
+        verts[10] = {bl.x + width, bl.y + height, bl.z};
+        verts[11] = {bl.x + width, bl.y + height, bl.z + depth};
+
+        verts[12] = {bl.x + width, bl.y + height, bl.z + depth};
+        verts[13] = {bl.x, bl.y + height, bl.z + depth};
+
+        verts[14] = {bl.x, bl.y + height, bl.z} ;
+        verts[15] = {bl.x, bl.y + height, bl.z + depth};
+
+        //pillars
+        verts[16] = {bl.x, bl.y , bl.z};
+        verts[17] = {bl.x, bl.y + height, bl.z};
+
+        verts[18] = {bl.x + width, bl.y , bl.z};
+        verts[19] = {bl.x + width, bl.y + height, bl.z};
+
+        verts[20] = {bl.x + width, bl.y, bl.z + depth};
+        verts[21] = {bl.x + width, bl.y + height, bl.z + depth};
+
+        verts[22] = {bl.x, bl.y, bl.z + depth};
+        verts[23] = {bl.x, bl.y + height, bl.z + depth};
+    }
+    DebugAABB()
+    {
+        memset(verts,0,sizeof(verts));
+    }
+
+};
+
+constexpr i32 MAX_DEBUG_LINES = 10;
+constexpr i32 MAX_DEBUG_AABB = 10;
+constexpr i32 MAX_POINT_LIGHTS = 1;
+
+
+// use vec4 given that in std340/std130 vec3 has an alignment of 16 bytes.
+// position.w holds the particle's draw group.
+struct ParticleData
+{
+    glmath::Vec4 position;
+    glmath::Vec4 colour;
+};
+
+// Consecutive particles added with the same radius. first indexes the frame's
+// particles in the order they were added, which the compact layouts keep; the
+// interleaved layout is reordered by sorting and carries the group itself.
+struct DrawGroup
+{
+    i64 first;
+    f32 radius;
+};
+
+// A DrawGroup as the vertex shader reads it, must match vertexShader.glsl
+struct GpuDrawGroup
+{
+    u32 first;
+    f32 radius;
+};
+
+enum class SortMode : u32
+{
+    STD_SORT, // comparison sort on the full structs, kept for reference
+    RADIX,    // depth keys + parallel radix sort over (key, index), then one gather
+    GPU_BITONIC, // compute shader keys + bitonic sort of the uploaded particles, the CPU never reorders them
+    TEMPORAL     // last frame's draw order re-keyed and repaired, for particles sent in the same order every frame
+};
+
+// Milliseconds spent in each stage of the last sortParticlesByDepth call.
+struct SortTimings
+{
+    f64 partition_ms;
+    f64 keys_ms;
+    f64 sort_ms;
+    f64 gather_ms;
+    f64 gpu_sort_ms; // GPU time of the most recent finished GPU_BITONIC sort, usually a frame behind
+    f64 total_ms;
+    f64 disorder;    // TEMPORAL: insertion moves per particle repairing last frame's order, -1 when it wasn't repaired
+    bool full_sort;  // TEMPORAL: sorted from scratch instead of repairing last frame's order
+    i64 n_particles;
+    i64 n_opaque;
+};
+
+// Outcome of the last cullParticles call, or summed over the views of the last renderViews.
+struct CullStats
+{
+    i64 n_visible;
+    i64 n_culled;
+    f64 cull_ms;
+};
+
+enum class ParticleLayout : u32
+{
+    INTERLEAVED, // one ParticleData per particle, 32 bytes
+    COMPACT,     // xyz f32 and RGBA8 colour streams plus a u32 draw order, 20 bytes
+    QUANTIZED    // COMPACT with xyz as u16 codes inside per-chunk bounds, 14 bytes
+};
+
+// SSBO binding points, must match vertexShader.glsl
+constexpr u32 PARTICLE_BINDING = 3;
+constexpr u32 COMPACT_POSITION_BINDING = 4;
+constexpr u32 COMPACT_COLOUR_BINDING = 5;
+constexpr u32 DRAW_ORDER_BINDING = 6;
+constexpr u32 QUANTIZED_POSITION_BINDING = 7;
+constexpr u32 QUANTIZED_CHUNK_BINDING = 8;
+constexpr u32 SORT_KEY_BINDING = 9;
+constexpr u32 SPHERE_MESH_BINDING = 10;
+constexpr u32 FRAGMENT_COUNT_BINDING = 11; // fragmentShader.glsl
+constexpr u32 DRAW_GROUP_BINDING = 12;
+
+constexpr i32 MAX_PARTICLE_STREAMS = 5; // QUANTIZED: codes, chunks, float chunks, colours, draw order
+
+// One SSBO range the particle draw reads from.
+struct ParticleStream
+{
+    u32 binding;
+    const void *data;
+    i64 bytes;
+    i64 offset;
+};
+
+// Every stream of one frame's particles, packed back to back at aligned
+// offsets. The interleaved layout always has its particles in stream 0 at offset 0.
+struct ParticleStreams
+{
+    std::array<ParticleStream, MAX_PARTICLE_STREAMS> streams;
+    i32 n_streams;
+    i64 total_bytes;
+};
+
+enum class UploadMode : u32
+{
+    BUFFER_SUB_DATA, // glBufferSubData of the whole particle array each frame
+    PERSISTENT_RING  // persistently mapped ring of SSBO slots guarded by fences, needs GL 4.4 or ARB_buffer_storage
+};
+
+constexpr i32 PARTICLE_RING_SLOTS = 3;
+
+// One immutable SSBO split into slots. The CPU fills slot n while the GPU may
+// still be reading slots n-1 and n-2; each slot's fence is waited on before reuse.
+struct ParticleRing
+{
+    u32 buffer;
+    u8 *mapped;
+    i64 slot_stride_bytes;
+    i32 slot;
+    std::array<GLsync, PARTICLE_RING_SLOTS> fences;
+};
+
+// How each particle's billboard reaches the vertex shader.
+enum class QuadPath : u32
+{
+    SIX_VERTEX,     // two triangles of non-indexed vertices, each inverting the view, kept for reference
+    INSTANCED_STRIP // one 4 vertex strip instance, the camera basis and view-projection computed once on the CPU
+};
+
+// How each particle's sphere is drawn.
+enum class SphereMode : u32
+{
+    FLAT_BILLBOARD, // quad at the centre's depth, shaded as a sphere but depth tested flat
+    RAY_CAST,       // the sphere's exact screen bounds at its nearest depth, each fragment ray cast for the sphere's own depth
+    MESH            // instanced icosphere, the geometry the impostors stand in for
+};
+
+constexpr i32 SPHERE_MESH_SUBDIVISIONS = 2; // 320 triangles
+
+enum class BlendMode : u32
+{
+    SORTED,      // back-to-front CPU depth sort, then over blending
+    WEIGHTED_OIT // weighted blended order-independent transparency, no sort
+};
+
+// Fragments of the particle draws since the frame began, counted in the
+// fragment shader while counting is on. Discarded ones missed the sphere.
+struct FragmentCounts
+{
+    i64 n_shaded;
+    i64 n_discarded;
+};
+
+// Offscreen targets of the weighted blended OIT pass, sized to cover the viewport.
+// The depth attachment is the target's own when it can be shared, otherwise
+// depth, which the opaque particles are drawn into a second time.
+struct OitTargets
+{
+    u32 framebuffer;
+    u32 accumulation; // RGBA16F, sum of premultiplied colour and alpha times weight
+    u32 revealage;    // R8, product of (1 - alpha)
+    u32 depth;        // DEPTH24, for targets whose depth can't be attached
+    bool shared_depth;
+    i32 width;
+    i32 height;
+};
+
+enum class ColourFormat : u32
+{
+    RGBA8,
+    RGB10_A2,
+    RGBA16F // keeps precision through many blended layers
+};
+
+enum class DepthFormat : u32
+{
+    DEPTH16,
+    DEPTH24,
+    DEPTH32F
+};
+
+// Offscreen framebuffer frames are drawn into and read back from. With more
+// than one sample the attachments are multisampled and resolve into a single
+// sample colour buffer; otherwise that is the colour attachment itself.
+struct RenderTarget
+{
+    u32 framebuffer;
+    u32 colour;
+    u32 depth;
+    u32 resolve_framebuffer;
+    u32 resolve_colour;
+    i32 width;
+    i32 height;
+    i32 samples;
+    ColourFormat colour_format;
+    DepthFormat depth_format;
+};
+
+// Offscreen layers renderViews draws one view into each of.
+struct ViewTargets
+{
+    u32 framebuffer;
+    u32 colour; // RGBA8 2D array
+    u32 depth;  // DEPTH24 2D array
+    u32 draw_order_buffer; // per view draw order of the particles uploaded once
+    i32 width;
+    i32 height;
+    i32 n_layers;
+};
+
+// One camera of renderViews.
+struct ViewCamera
+{
+    glmath::Mat4x4 view;
+    glmath::Vec3 pos;
+};
+
+// Must match depthSortCS.glsl
+constexpr i64 GPU_SORT_GROUP_SIZE = 256;
+constexpr i64 GPU_SORT_BLOCK_SIZE = 512;
+
+enum class GpuSortStage : u32
+{
+    GENERATE_KEYS,
+    SORT_BLOCKS,
+    MERGE_GLOBAL,
+    MERGE_BLOCKS
+};
+
+// Compute program and scratch of the GPU depth sort. The buffer holds a power
+// of two number of keys followed by as many indices, which become the draw order.
+struct GpuSort
+{
+    i32 program;
+    u32 buffer;
+    i64 capacity_bytes;
+    u32 timer_query;
+    bool timer_pending;
+    f64 last_sort_ms;
+
+    i32 stage_uniform;
+    i32 particle_layout_uniform;
+    i32 n_particles_uniform;
+    i32 merge_size_uniform;
+    i32 compare_distance_uniform;
+    i32 camera_pos_uniform;
+};
+
+constexpr i32 MAX_READBACK_LATENCY = 2;
+
+// One pixel pack buffer a frame is read back into. The copy runs on the GPU
+// timeline and the fence says when the pixels can be mapped.
+struct ReadbackSlot
+{
+    u32 buffer;
+    i64 capacity_bytes;
+    GLsync fence;
+    i32 width;
+    i32 height;
+};
+
+// FIFO of in-flight RGB readbacks. With a latency of n the readback of frame N
+// is collected while frame N + n is rendered; 0 reads back synchronously.
+struct ReadbackRing
+{
+    std::array<ReadbackSlot, MAX_READBACK_LATENCY + 1> slots;
+    i32 latency;
+    i32 oldest;
+    i32 n_pending;
+};
+
+struct Renderer
+{
+    SubArena debug_render_data; 
+    std::span<DebugAABB> debug_aabb;
+    std::span<Line> debug_lines;
+    std::span<glmath::Vec3> colour;
+
+    // SubArena dynamic_render_data; 
+    // std::span<ParticleData> particle_data;
+    // std::span<glmath::Vec4> light_pos;
+    UninitialisedVector<ParticleData> particle_data;
+    std::array<glmath::Vec3, MAX_POINT_LIGHTS> light_pos;
+
+    SortMode sort_mode = SortMode::RADIX;
+    SortTimings sort_timings;
+    std::vector<u32> sort_keys;
+    std::vector<u32> sort_indices;
+    UninitialisedVector<ParticleData> sorted_particle_data;
+    RadixSortScratch radix_scratch;
+    std::vector<i64> partition_counts;
+    std::vector<u32> temporal_order; // TEMPORAL: translucent draw order of the last frame, kept across frames
+    std::vector<u64> temporal_pairs;
+    i32 temporal_backoff = 0;        // frames radix sorted after the last repair that gave up, 0 after one that didn't
+    i32 temporal_frames_to_skip = 0; // left of them
+    i64 n_opaque_particles; // the first n_opaque_particles in draw order have alpha 1 and are drawn unsorted
+    bool frustum_culling;
+    CullStats cull_stats;
+    UninitialisedVector<u8> particle_visible;
+    std::vector<i64> cull_counts;
+    UninitialisedVector<f32> culled_positions;
+    UninitialisedVector<u32> culled_colours;
+
+    GpuSort gpu_sort;
+    glmath::Vec3 sort_camera_pos;
+    bool gpu_sort_pending; // this frame is sorted on the GPU once uploaded
+
+    ParticleLayout particle_layout;
+    UninitialisedVector<f32> compact_positions;
+    UninitialisedVector<u32> compact_colours;
+    bool draw_order_ready; // sort_indices holds this frame's draw order
+
+    f32 particle_radius; // radius of the particles added next
+    std::vector<DrawGroup> draw_groups;
+    std::vector<GpuDrawGroup> gpu_draw_groups;
+    u32 draw_group_buffer;
+    i64 draw_group_capacity_bytes;
+    f32 quantization_tolerance; // largest allowed position error as a fraction of the radius
+    f32 quantization_error;     // largest position error of the chunks quantized in the last frame
+    UninitialisedVector<u16> quantized_positions;
+    UninitialisedVector<QuantizedChunk> quantized_chunks;
+    UninitialisedVector<f32> float_chunk_positions; // chunks too spread out to quantize, see QuantizedChunk
+
+    QuadPath quad_path = QuadPath::INSTANCED_STRIP;
+    SphereMode sphere_mode = SphereMode::FLAT_BILLBOARD;
+    bool count_fragments = false;
+    u32 fragment_count_buffer = 0;
+    u32 sphere_mesh_vertices;
+    u32 sphere_mesh_indices;
+    i32 n_sphere_mesh_indices;
+    BlendMode blend_mode;
+    OitTargets oit_targets;
+    ViewTargets view_targets;
+    RenderTarget render_target;
+
+    ReadbackRing readback_ring;
+    GpuProfiler gpu_profiler;
+
+    UploadMode upload_mode;
+    ParticleRing particle_ring;
+    u8 *staged_slot; // set once this frame's particles are already in the ring slot
+    i32 ssbo_offset_alignment;
+
+    i64 dynamic_sso_capacity_bytes;
+    u32 dynamic_sso;
+
+    u32 debug_vao;
+    u32 dummy_vao; 
+
+    i32 debug_colours_uniform;
+
+    i32 shader_program;      // the variant in use, see useParticleProgram
+    i32 fixed_depth_program; // FLAT_BILLBOARD and MESH, never write gl_FragDepth
+    i32 ray_cast_program;    // RAY_CAST, writes the depth of the ray's hit
+
+    i32 render_mode_uniform;
+    i32 projection_uniform;
+    i32 view_uniform;
+    i32 point_light_uniform;
+
+    i32 n_draw_groups_uniform;
+    i32 particle_layout_uniform;
+    i32 gpu_sorted_uniform;
+    i32 quad_path_uniform;
+    i32 billboard_right_uniform;
+    i32 billboard_up_uniform;
+    i32 view_projection_uniform;
+    i32 first_particle_uniform;
+    i32 sphere_mode_uniform;
+    i32 count_fragments_uniform;
+    i32 blend_mode_uniform;
+    i32 oit_accumulation_uniform;
+    i32 oit_revealage_uniform;
+};
+
+
+// Setup and settings.
+i32 initialiseRenderer(Renderer &render_manager);
+void setUploadMode(Renderer &renderer, UploadMode mode);
+void setParticleLayout(Renderer &renderer, ParticleLayout layout);
+void setFragmentCounting(Renderer &renderer, bool enabled);
+FragmentCounts readFragmentCounts(const Renderer &renderer);
+
+// A frame: particles are added, culled and sorted, then drawn.
+void setRadius(Renderer &renderer, f32 radius);
+void ingestParticles(Renderer &renderer, const IngestSource &positions, const IngestSource &colours);
+void cullParticles(Renderer &renderer, const glmath::Mat4x4 &view_projection);
+void sortParticlesByDepth(Renderer &renderer, const glmath::Vec3 &camera_pos);
+bool sortUsesGl(const Renderer &renderer);
+void renderScene(Renderer &renderer, const glmath::Mat4x4 &view, const glmath::Mat4x4 &projection);
+void renderViews(Renderer &renderer, std::span<const ViewCamera> cameras, const glmath::Mat4x4 &projection, i32 width, i32 height);
+
+// Render targets and reading frames back.
+void resizeRenderTarget(RenderTarget &target, i32 width, i32 height, i32 samples, ColourFormat colour_format, DepthFormat depth_format);
+void bindRenderTarget(const RenderTarget &target);
+void resolveRenderTarget(const RenderTarget &target);
+void readPixelsRGB(i32 width, i32 height, u8 *pixels, bool flip, std::vector<u8> &row_scratch);
+void readViewsRGB(const ViewTargets &targets, u8 *pixels, bool flip, std::vector<u8> &row_scratch);
+void issueReadback(ReadbackRing &ring, i32 width, i32 height);
+const ReadbackSlot &oldestReadback(const ReadbackRing &ring);
+void collectReadback(ReadbackRing &ring, u8 *pixels, bool flip);
+
+f64 millisecondsSince(std::chrono::steady_clock::time_point start);
+
+#endif
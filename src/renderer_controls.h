@@ -0,0 +1,177 @@
+#ifndef RENDERER_CONTROLS_H
+#define RENDERER_CONTROLS_H
+
+#include "renderer.h"
+
+#if PYTHON_BINDING
+#include <nanobind/nanobind.h>
+#endif
+
+
+// The renderer and the settings and statistics every front end exposes. Each
+// front end's GlRenderer derives from it and adds its own surface and output.
+struct RendererControls
+{
+    Renderer renderer;
+
+    void setSortMode(SortMode mode)
+    {
+        renderer.sort_mode = mode;
+    }
+
+    void setFrustumCulling(bool enabled)
+    {
+        renderer.frustum_culling = enabled;
+    }
+
+    void setBlendMode(BlendMode mode)
+    {
+        renderer.blend_mode = mode;
+    }
+
+    void setQuadPath(QuadPath path)
+    {
+        renderer.quad_path = path;
+    }
+
+    void setSphereMode(SphereMode mode)
+    {
+        renderer.sphere_mode = mode;
+    }
+
+    // Counts particle fragments shaded and discarded, for measuring overdraw.
+    void setFragmentCounting(bool enabled)
+    {
+        ::setFragmentCounting(renderer, enabled);
+    }
+
+    void setUploadMode(UploadMode mode)
+    {
+        ::setUploadMode(renderer, mode);
+    }
+
+    void setParticleLayout(ParticleLayout layout)
+    {
+        ::setParticleLayout(renderer, layout);
+    }
+
+    // Largest quantization error allowed, as a fraction of the particle radius.
+    void setQuantizationTolerance(f32 radius_fraction)
+    {
+        renderer.quantization_tolerance = radius_fraction;
+    }
+
+    f32 getQuantizationError()
+    {
+        return renderer.quantization_error;
+    }
+
+    // Times each pass and counts the particle draw's samples and primitives,
+    // read a few frames later so profiling doesn't stall the pipeline.
+    void setGpuProfiling(bool enabled)
+    {
+        ::setGpuProfiling(renderer.gpu_profiler, enabled);
+    }
+
+    // Stats of the latest frame whose queries have finished, usually a few frames behind.
+    GpuStats getGpuStats()
+    {
+        return renderer.gpu_profiler.stats;
+    }
+
+#if PYTHON_BINDING
+    nanobind::dict getSortTimings()
+    {
+        const SortTimings &timings = renderer.sort_timings;
+        nanobind::dict result;
+        result["n_particles"] = timings.n_particles;
+        result["n_opaque"] = timings.n_opaque;
+        result["partition_ms"] = timings.partition_ms;
+        result["keys_ms"] = timings.keys_ms;
+        result["sort_ms"] = timings.sort_ms;
+        result["gather_ms"] = timings.gather_ms;
+        result["gpu_sort_ms"] = timings.gpu_sort_ms;
+        result["total_ms"] = timings.total_ms;
+        result["disorder"] = timings.disorder;
+        result["full_sort"] = timings.full_sort;
+        return result;
+    }
+
+    nanobind::dict getCullStats()
+    {
+        const CullStats &stats = renderer.cull_stats;
+        nanobind::dict result;
+        result["n_visible"] = stats.n_visible;
+        result["n_culled"] = stats.n_culled;
+        result["cull_ms"] = stats.cull_ms;
+        return result;
+    }
+
+    // Counts from the last render, -1 when counting was never enabled.
+    nanobind::dict getFragmentCounts()
+    {
+        const FragmentCounts counts = readFragmentCounts(renderer);
+        nanobind::dict result;
+        result["n_shaded"] = counts.n_shaded;
+        result["n_discarded"] = counts.n_discarded;
+        return result;
+    }
+#endif
+};
+
+
+#if PYTHON_BINDING
+// Binds the renderer's modes and RendererControls, which each front end then
+// names as the base of its GlRenderer.
+void bindRendererControls(nanobind::module_ &m)
+{
+    bindGpuStats(m);
+
+    nanobind::enum_<SortMode>(m, "SortMode")
+        .value("STD_SORT", SortMode::STD_SORT)
+        .value("RADIX", SortMode::RADIX)
+        .value("GPU_BITONIC", SortMode::GPU_BITONIC)
+        .value("TEMPORAL", SortMode::TEMPORAL);
+
+    nanobind::enum_<BlendMode>(m, "BlendMode")
+        .value("SORTED", BlendMode::SORTED)
+        .value("WEIGHTED_OIT", BlendMode::WEIGHTED_OIT);
+
+    nanobind::enum_<QuadPath>(m, "QuadPath")
+        .value("SIX_VERTEX", QuadPath::SIX_VERTEX)
+        .value("INSTANCED_STRIP", QuadPath::INSTANCED_STRIP);
+
+    nanobind::enum_<SphereMode>(m, "SphereMode")
+        .value("FLAT_BILLBOARD", SphereMode::FLAT_BILLBOARD)
+        .value("RAY_CAST", SphereMode::RAY_CAST)
+        .value("MESH", SphereMode::MESH);
+
+    nanobind::enum_<UploadMode>(m, "UploadMode")
+        .value("BUFFER_SUB_DATA", UploadMode::BUFFER_SUB_DATA)
+        .value("PERSISTENT_RING", UploadMode::PERSISTENT_RING);
+
+    nanobind::enum_<ParticleLayout>(m, "ParticleLayout")
+        .value("INTERLEAVED", ParticleLayout::INTERLEAVED)
+        .value("COMPACT", ParticleLayout::COMPACT)
+        .value("QUANTIZED", ParticleLayout::QUANTIZED);
+
+    nanobind::class_<RendererControls>(m, "RendererControls")
+        .def("setSortMode", &RendererControls::setSortMode)
+        .def("setBlendMode", &RendererControls::setBlendMode)
+        .def("setQuadPath", &RendererControls::setQuadPath)
+        .def("setSphereMode", &RendererControls::setSphereMode)
+        .def("setFragmentCounting", &RendererControls::setFragmentCounting)
+        .def("setUploadMode", &RendererControls::setUploadMode)
+        .def("setParticleLayout", &RendererControls::setParticleLayout)
+        .def("setQuantizationTolerance", &RendererControls::setQuantizationTolerance)
+        .def("getQuantizationError", &RendererControls::getQuantizationError)
+        .def("setFrustumCulling", &RendererControls::setFrustumCulling)
+        .def("setGpuProfiling", &RendererControls::setGpuProfiling)
+        .def("getGpuStats", &RendererControls::getGpuStats)
+        .def("getCullStats", &RendererControls::getCullStats)
+        .def("getFragmentCounts", &RendererControls::getFragmentCounts)
+        .def("getSortTimings", &RendererControls::getSortTimings);
+}
+#endif
+
+#endif
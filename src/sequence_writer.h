@@ -0,0 +1,108 @@
+#ifndef SEQUENCE_WRITER_H
+#define SEQUENCE_WRITER_H
+
+#include "defintions.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+// An uncompressed frame sequence: a .npy file of shape (frames, height, width, 3)
+// uint8, preallocated for the expected number of frames and mapped, so frames
+// are read back straight into the file with no per-frame encoding or file
+// creation. numpy.load(path, mmap_mode="r") reads it without copying.
+struct SequenceWriter
+{
+    i32 file;
+    u8 *mapped;
+    i64 capacity_frames;
+    i64 n_frames;
+    i32 width;
+    i32 height;
+};
+
+// Fixed header size, so the shape can be rewritten in place when the sequence
+// ends early. The npy format wants data aligned to 64 bytes.
+constexpr i64 NPY_HEADER_SIZE = 128;
+
+inline i64 sequenceFrameBytes(const SequenceWriter &sequence)
+{
+    return static_cast<i64>(sequence.width) * sequence.height * 3;
+}
+
+void writeNpyHeader(u8 *header, i64 n_frames, i32 width, i32 height)
+{
+    constexpr char magic[] = "\x93NUMPY\x01\x00";
+    memcpy(header, magic, 8);
+    const u16 dict_bytes = static_cast<u16>(NPY_HEADER_SIZE - 10);
+    header[8] = static_cast<u8>(dict_bytes & 0xFF);
+    header[9] = static_cast<u8>(dict_bytes >> 8);
+
+    char *dict = reinterpret_cast<char*>(header + 10);
+    const i32 length = snprintf(dict, dict_bytes, "{'descr': '|u1', 'fortran_order': False, 'shape': (%lld, %d, %d, 3), }", n_frames, height, width);
+    RENDERER_ASSERT(length > 0 && length < dict_bytes, "npy header doesn't fit in %lld bytes.", NPY_HEADER_SIZE);
+    // Space padded and newline terminated, as numpy writes it.
+    memset(dict + length, ' ', dict_bytes - length - 1);
+    dict[dict_bytes - 1] = '\n';
+}
+
+// Creates path with room for n_frames frames of width x height. Returns false
+// if the file can't be created, sized or mapped.
+bool openSequence(SequenceWriter &sequence, const char *path, i64 n_frames, i32 width, i32 height)
+{
+    RENDERER_ASSERT(sequence.mapped == nullptr, "A sequence is already open.");
+    RENDERER_ASSERT(n_frames > 0, "Expected a positive frame count, got %lld.", n_frames);
+    sequence = {.file = -1, .mapped = nullptr, .capacity_frames = n_frames, .n_frames = 0, .width = width, .height = height};
+    const i64 bytes = NPY_HEADER_SIZE + n_frames * sequenceFrameBytes(sequence);
+
+    sequence.file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(sequence.file < 0)
+        return false;
+    // Allocate up front so running out of disk fails here rather than as a
+    // SIGBUS on some later frame.
+    void *mapped = MAP_FAILED;
+    if(posix_fallocate(sequence.file, 0, bytes) == 0)
+        mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, sequence.file, 0);
+    if(mapped == MAP_FAILED)
+    {
+        close(sequence.file);
+        unlink(path);
+        sequence.file = -1;
+        return false;
+    }
+    sequence.mapped = static_cast<u8*>(mapped);
+    writeNpyHeader(sequence.mapped, n_frames, width, height);
+    return true;
+}
+
+// Where the next frame's pixels go, top row first.
+u8 *nextSequenceFrame(SequenceWriter &sequence)
+{
+    RENDERER_ASSERT(sequence.mapped != nullptr, "No sequence is open.");
+    RENDERER_ASSERT(sequence.n_frames < sequence.capacity_frames, "The sequence is full at %lld frames.", sequence.capacity_frames);
+    return sequence.mapped + NPY_HEADER_SIZE + sequence.n_frames++ * sequenceFrameBytes(sequence);
+}
+
+// Unmaps and closes the file, shrinking it to the frames written. Returns the
+// number of frames in it.
+i64 closeSequence(SequenceWriter &sequence)
+{
+    RENDERER_ASSERT(sequence.mapped != nullptr, "No sequence is open.");
+    const i64 n_frames = sequence.n_frames;
+    const i64 capacity_bytes = NPY_HEADER_SIZE + sequence.capacity_frames * sequenceFrameBytes(sequence);
+    if(n_frames < sequence.capacity_frames)
+        writeNpyHeader(sequence.mapped, n_frames, sequence.width, sequence.height);
+    munmap(sequence.mapped, capacity_bytes);
+    if(n_frames < sequence.capacity_frames)
+    {
+        const i32 truncated = ftruncate(sequence.file, NPY_HEADER_SIZE + n_frames * sequenceFrameBytes(sequence));
+        RENDERER_ASSERT(truncated == 0, "Couldn't shrink the sequence file.");
+    }
+    close(sequence.file);
+    sequence = {};
+    return n_frames;
+}
+
+#endif
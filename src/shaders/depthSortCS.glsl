@@ -0,0 +1,219 @@
+#version 430 core
+
+// Bitonic sort of (depth key, particle index) pairs over a power of two number
+// of slots. Slots past n_particles hold the largest key and sort to the end,
+// opaque particles the smallest and sort to the front, ahead of the translucent
+// ones back to front. The sorted indices are the draw order vertexShader.glsl reads.
+
+#define SORT_GROUP_SIZE 256
+#define SORT_BLOCK_SIZE 512 // two slots per invocation
+
+layout(local_size_x = SORT_GROUP_SIZE) in;
+
+uniform uint sort_stage;
+#define GENERATE_KEYS 0
+#define SORT_BLOCKS 1  // every merge up to SORT_BLOCK_SIZE, in shared memory
+#define MERGE_GLOBAL 2 // one compare distance >= SORT_BLOCK_SIZE of a merge, in global memory
+#define MERGE_BLOCKS 3 // the remaining compare distances of a merge, in shared memory
+
+uniform uint particle_layout;
+#define INTERLEAVED 0
+#define COMPACT 1
+#define QUANTIZED 2
+#define QUANTIZED_CHUNK_SIZE 256
+#define QUANTIZED_CODES 0xFFFFFFFFu
+
+uniform uint n_particles;
+uniform uint merge_size;
+uniform uint compare_distance;
+uniform vec3 camera_pos_ws;
+
+
+struct ParticleData
+{
+    vec3 position;
+    vec4 colour;
+};
+
+layout(std430, binding = 3) readonly buffer position_buffer
+{
+    ParticleData particle[];
+};
+
+layout(std430, binding = 4) readonly buffer compact_position_buffer
+{
+    float compact_position[];
+};
+
+layout(std430, binding = 5) readonly buffer compact_colour_buffer
+{
+    uint compact_colour[];
+};
+
+layout(std430, binding = 6) buffer draw_order_buffer
+{
+    uint draw_order[];
+};
+
+struct QuantizedChunk
+{
+    vec3 min;
+    uint float_chunk; // QUANTIZED_CODES, or its slot of xyz floats in compact_position
+    vec4 step;
+};
+
+layout(std430, binding = 7) readonly buffer quantized_position_buffer
+{
+    uint quantized_position[];
+};
+
+layout(std430, binding = 8) readonly buffer quantized_chunk_buffer
+{
+    QuantizedChunk quantized_chunk[];
+};
+
+layout(std430, binding = 9) buffer sort_key_buffer
+{
+    uint sort_key[];
+};
+
+
+uint quantizedCode(uint code_idx)
+{
+    return (quantized_position[code_idx >> 1] >> ((code_idx & 1u) * 16u)) & 0xFFFFu;
+}
+
+vec3 particlePosition(uint particle_idx)
+{
+    if(particle_layout == QUANTIZED)
+    {
+        QuantizedChunk chunk = quantized_chunk[particle_idx / QUANTIZED_CHUNK_SIZE];
+        if(chunk.float_chunk != QUANTIZED_CODES)
+        {
+            uint float_idx = chunk.float_chunk * QUANTIZED_CHUNK_SIZE + particle_idx % QUANTIZED_CHUNK_SIZE;
+            return vec3(compact_position[3 * float_idx], compact_position[3 * float_idx + 1], compact_position[3 * float_idx + 2]);
+        }
+        uvec3 code = uvec3(quantizedCode(3 * particle_idx), quantizedCode(3 * particle_idx + 1), quantizedCode(3 * particle_idx + 2));
+        return chunk.min.xyz + vec3(code) * chunk.step.xyz;
+    }
+    if(particle_layout == COMPACT)
+        return vec3(compact_position[3 * particle_idx], compact_position[3 * particle_idx + 1], compact_position[3 * particle_idx + 2]);
+    return particle[particle_idx].position;
+}
+
+bool particleOpaque(uint particle_idx)
+{
+    if(particle_layout == INTERLEAVED)
+        return particle[particle_idx].colour.a >= 1.0;
+    return (compact_colour[particle_idx] >> 24) == 0xFFu;
+}
+
+
+shared uint block_key[SORT_BLOCK_SIZE];
+shared uint block_index[SORT_BLOCK_SIZE];
+
+// Slot pair compared by invocation i at the given distance: the lower slot has bit distance clear.
+uint lowerSlot(uint i, uint distance)
+{
+    return 2 * i - (i & (distance - 1));
+}
+
+void compareExchangeShared(uint lower, uint distance, bool ascending)
+{
+    uint upper = lower + distance;
+    if((block_key[lower] > block_key[upper]) == ascending)
+    {
+        uint key = block_key[lower];
+        block_key[lower] = block_key[upper];
+        block_key[upper] = key;
+        uint index = block_index[lower];
+        block_index[lower] = block_index[upper];
+        block_index[upper] = index;
+    }
+}
+
+void loadBlock(uint block_start)
+{
+    uint local_id = gl_LocalInvocationID.x;
+    block_key[local_id] = sort_key[block_start + local_id];
+    block_index[local_id] = draw_order[block_start + local_id];
+    block_key[local_id + SORT_GROUP_SIZE] = sort_key[block_start + local_id + SORT_GROUP_SIZE];
+    block_index[local_id + SORT_GROUP_SIZE] = draw_order[block_start + local_id + SORT_GROUP_SIZE];
+    barrier();
+}
+
+void storeBlock(uint block_start)
+{
+    barrier();
+    uint local_id = gl_LocalInvocationID.x;
+    sort_key[block_start + local_id] = block_key[local_id];
+    draw_order[block_start + local_id] = block_index[local_id];
+    sort_key[block_start + local_id + SORT_GROUP_SIZE] = block_key[local_id + SORT_GROUP_SIZE];
+    draw_order[block_start + local_id + SORT_GROUP_SIZE] = block_index[local_id + SORT_GROUP_SIZE];
+}
+
+// Runs compare distances first_distance .. 1 of merges of the given size inside the block.
+void mergeBlock(uint block_start, uint size, uint first_distance)
+{
+    uint local_id = gl_LocalInvocationID.x;
+    for(uint distance = first_distance; distance > 0; distance >>= 1)
+    {
+        uint lower = lowerSlot(local_id, distance);
+        compareExchangeShared(lower, distance, ((block_start + lower) & size) == 0);
+        barrier();
+    }
+}
+
+
+void main()
+{
+    if(sort_stage == GENERATE_KEYS)
+    {
+        uint slot = gl_GlobalInvocationID.x;
+        uint key = 0xFFFFFFFFu;
+        if(slot < n_particles && particleOpaque(slot))
+        {
+            key = 0u;
+        }
+        else if(slot < n_particles)
+        {
+            vec3 offset = camera_pos_ws - particlePosition(slot);
+            // Same key as the CPU sort: ascending order is back to front.
+            key = ~floatBitsToUint(dot(offset, offset));
+        }
+        sort_key[slot] = key;
+        draw_order[slot] = slot;
+        return;
+    }
+
+    uint block_start = gl_WorkGroupID.x * SORT_BLOCK_SIZE;
+    if(sort_stage == SORT_BLOCKS)
+    {
+        loadBlock(block_start);
+        for(uint size = 2; size <= SORT_BLOCK_SIZE; size <<= 1)
+            mergeBlock(block_start, size, size >> 1);
+        storeBlock(block_start);
+    }
+    else if(sort_stage == MERGE_GLOBAL)
+    {
+        uint lower = lowerSlot(gl_GlobalInvocationID.x, compare_distance);
+        uint upper = lower + compare_distance;
+        bool ascending = (lower & merge_size) == 0;
+        uint lower_key = sort_key[lower];
+        uint upper_key = sort_key[upper];
+        if((lower_key > upper_key) == ascending)
+        {
+            sort_key[lower] = upper_key;
+            sort_key[upper] = lower_key;
+            uint index = draw_order[lower];
+            draw_order[lower] = draw_order[upper];
+            draw_order[upper] = index;
+        }
+    }
+    else if(sort_stage == MERGE_BLOCKS)
+    {
+        loadBlock(block_start);
+        mergeBlock(block_start, merge_size, SORT_BLOCK_SIZE >> 1);
+        storeBlock(block_start);
+    }
+}
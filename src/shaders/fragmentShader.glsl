@@ -9,17 +9,59 @@
 uniform uint render_mode;
 #define DEBUG 0
 #define DIFFUSE 1
+#define COMPOSITE 2
+
+uniform uint blend_mode;
+#define SORTED 0
+#define WEIGHTED_OIT 1
+
+uniform uint sphere_mode;
+#define FLAT_BILLBOARD 0
+#define RAY_CAST 1
+#define MESH 2
+
+// Defined for the RAY_CAST program only, the others leave depth to the rasteriser
+// and keep early depth tests. RAY_CAST only ever pushes depth back from its quad's,
+// which keeps early depth rejection
+#ifdef RAY_CAST_DEPTH
+layout(depth_greater) out float gl_FragDepth;
+#endif
+
+// Measuring only: every particle fragment counts itself as shaded or discarded
+uniform bool count_fragments;
+layout(std430, binding = 11) buffer fragment_count_buffer
+{
+    uint n_shaded_fragments;
+    uint n_discarded_fragments;
+};
+
+void countFragment(bool discarded)
+{
+    if(!count_fragments)
+        return;
+    if(discarded)
+        atomicAdd(n_discarded_fragments, 1u);
+    else
+        atomicAdd(n_shaded_fragments, 1u);
+}
 
+// With WEIGHTED_OIT, colour is the accumulation target and revealage the second target
+layout(location = 0) out vec4 colour;
+layout(location = 1) out vec4 revealage;
 
-out vec4 colour;
+uniform sampler2D oit_accumulation;
+uniform sampler2D oit_revealage;
 
 in vec2 uv;
 in VECTOR3 particle_pos_vs;
 in vec4 diffuse_colour;
+flat in float particle_radius;
+in VECTOR3 quad_pos_vs;
+in VECTOR3 mesh_normal_vs;
 
 
 uniform VECTOR3 camera_pos_ws;
-uniform float radius;
+uniform MATRIX4 projection;
 
 
 uniform VECTOR3 point_lights_ws[MAX_POINT_LIGHTS];
@@ -57,14 +99,38 @@ VECTOR3 goochDiffuse(VECTOR3 normal, VECTOR3 light_dir, VECTOR3 colour)
     return diffuse;
 }
 
+// Depth weight from equation 7 of McGuire and Bavoil 2013, view space depth
+float oitWeight(float depth_vs, float alpha)
+{
+    float z = abs(depth_vs);
+    return alpha * clamp(10.0 / (1e-5 + pow(z / 5.0, 2.0) + pow(z / 200.0, 6.0)), 1e-2, 3e3);
+}
+
 void main()
 {
+    if(render_mode == COMPOSITE)
+    {
+        ivec2 texel = ivec2(gl_FragCoord.xy);
+        float transmittance = texelFetch(oit_revealage, texel, 0).r;
+        if(transmittance == 1.0)
+            discard;
+        vec4 accumulation = texelFetch(oit_accumulation, texel, 0);
+        colour = vec4(accumulation.rgb / clamp(accumulation.a, 1e-4, 5e4), transmittance);
+        return;
+    }
+
     // colour =  vec4(1.0,1.0,1.0,1.0);
     // return;
+#ifdef RAY_CAST_DEPTH
+    gl_FragDepth = gl_FragCoord.z;
+#endif
     float length_squared = dot(uv,uv);
 
-    if(length_squared > 1.0)
+    if(length_squared > 1.0 && sphere_mode == FLAT_BILLBOARD)
+    {
+        countFragment(true);
         discard;
+    }
 
 
     if(render_mode == DEBUG)
@@ -80,8 +146,39 @@ void main()
 
 
         VECTOR3 normal_with_z =  VECTOR3(uv, -sqrt(1.0 - length_squared));
-
-        VECTOR3 frag_pos_vs = radius * normal_with_z + particle_pos_vs;
+        if(sphere_mode == MESH)
+        {
+            normal_with_z = normalize(mesh_normal_vs);
+        }
+        else if(sphere_mode == RAY_CAST)
+        {
+            // Nearest hit of the view ray through this fragment, with the
+            // distance from the centre measured across the ray to keep precision
+            VECTOR3 ray = normalize(quad_pos_vs);
+            float along = dot(ray, particle_pos_vs);
+            VECTOR3 across = particle_pos_vs - along * ray;
+            float half_chord_squared = particle_radius * particle_radius - dot(across, across);
+            if(half_chord_squared < 0.0)
+            {
+                countFragment(true);
+                discard;
+            }
+            VECTOR3 hit_vs = (along - sqrt(half_chord_squared)) * ray;
+            normal_with_z = (hit_vs - particle_pos_vs) / particle_radius;
+
+            // Hits before the near plane are clipped, as a mesh's would be
+            vec4 hit_clip = projection * vec4(hit_vs, 1.0);
+            if(hit_clip.z < -hit_clip.w)
+            {
+                countFragment(true);
+                discard;
+            }
+#ifdef RAY_CAST_DEPTH
+            gl_FragDepth = (gl_DepthRange.diff * hit_clip.z / hit_clip.w + gl_DepthRange.near + gl_DepthRange.far) / 2.0;
+#endif
+        }
+
+        VECTOR3 frag_pos_vs = particle_radius * normal_with_z + particle_pos_vs;
         
         VECTOR3 light_dir = normalize(light_pos_vs - frag_pos_vs);
 
@@ -94,5 +191,12 @@ void main()
 
         colour = vec4(diffuse + ambient, particle_alpha);
 
+        if(blend_mode == WEIGHTED_OIT)
+        {
+            colour = vec4(colour.rgb * particle_alpha, particle_alpha) * oitWeight(frag_pos_vs.z, particle_alpha);
+            revealage = vec4(particle_alpha);
+        }
+
     }
+    countFragment(false);
 }
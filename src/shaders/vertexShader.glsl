@@ -3,6 +3,32 @@
 uniform uint render_mode;
 #define DEBUG 0
 #define DIFFUSE 1
+#define COMPOSITE 2
+
+uniform uint particle_layout;
+#define INTERLEAVED 0
+#define COMPACT 1
+#define QUANTIZED 2
+#define QUANTIZED_CHUNK_SIZE 256
+#define QUANTIZED_CODES 0xFFFFFFFFu
+
+// Set when depthSortCS.glsl wrote the draw order, which the interleaved layout then reads through too
+uniform bool gpu_sorted;
+
+uniform uint quad_path;
+#define SIX_VERTEX 0       // six vertices per particle, the basis from inverse(view) per vertex
+#define INSTANCED_STRIP 1  // a 4 vertex strip per instance, basis and view_projection from the CPU
+
+// INSTANCED_STRIP and MESH: world space camera right and up, and the particle of instance 0
+uniform vec3 billboard_right;
+uniform vec3 billboard_up;
+uniform mat4 view_projection;
+uniform uint first_particle;
+
+uniform uint sphere_mode;
+#define FLAT_BILLBOARD 0 // quad at the centre's depth
+#define RAY_CAST 1       // the sphere's screen bounds at its nearest depth, the fragment shader finds the surface
+#define MESH 2           // one icosphere instance per particle, drawn with its own indices
 
 #define VECTOR3 vec3 
 #define MATRIX4 mat4 
@@ -21,16 +47,18 @@ out VECTOR3 debug_colour;
 
 
 uniform VECTOR3 point_lights_ws[MAX_POINT_LIGHTS];
-uniform float radius;
+
+uniform uint n_draw_groups;
 uniform MATRIX4 view;
 uniform MATRIX4 projection;
 
 
 
 
+// position.w is the particle's draw group
 struct ParticleData
 {
-    VECTOR3 position;
+    vec4 position;
     vec4 colour;
 };
 
@@ -39,8 +67,98 @@ layout(std430, binding = 3) readonly buffer position_buffer
     ParticleData particle[];
 };
 
+// Compact layout: tightly packed xyz, RGBA8 colours and the sorted draw order
+layout(std430, binding = 4) readonly buffer compact_position_buffer
+{
+    float compact_position[];
+};
+
+layout(std430, binding = 5) readonly buffer compact_colour_buffer
+{
+    uint compact_colour[];
+};
+
+layout(std430, binding = 6) readonly buffer draw_order_buffer
+{
+    uint draw_order[];
+};
+
+// Quantized layout: three u16 codes per particle, decoded against the bounds of its chunk,
+// or floats in compact_position for the chunks that kept them
+struct QuantizedChunk
+{
+    vec3 min;
+    uint float_chunk; // QUANTIZED_CODES, or its slot of xyz floats in compact_position
+    vec4 step;
+};
+
+layout(std430, binding = 7) readonly buffer quantized_position_buffer
+{
+    uint quantized_position[];
+};
+
+layout(std430, binding = 8) readonly buffer quantized_chunk_buffer
+{
+    QuantizedChunk quantized_chunk[];
+};
+
+// Unit icosphere of the MESH mode, xyz of each vertex
+layout(std430, binding = 10) readonly buffer sphere_mesh_buffer
+{
+    vec4 sphere_mesh_vertex[];
+};
+
+// Radius of every draw group, and for the compact layouts the first particle of each
+struct DrawGroup
+{
+    uint first;
+    float radius;
+};
+
+layout(std430, binding = 12) readonly buffer draw_group_buffer
+{
+    DrawGroup draw_group[];
+};
+
+uint quantizedCode(uint code_idx)
+{
+    return (quantized_position[code_idx >> 1] >> ((code_idx & 1u) * 16u)) & 0xFFFFu;
+}
+
+vec3 decodeQuantizedPosition(uint particle_idx)
+{
+    QuantizedChunk chunk = quantized_chunk[particle_idx / QUANTIZED_CHUNK_SIZE];
+    if(chunk.float_chunk != QUANTIZED_CODES)
+    {
+        uint float_idx = chunk.float_chunk * QUANTIZED_CHUNK_SIZE + particle_idx % QUANTIZED_CHUNK_SIZE;
+        return vec3(compact_position[3 * float_idx], compact_position[3 * float_idx + 1], compact_position[3 * float_idx + 2]);
+    }
+    uvec3 code = uvec3(quantizedCode(3 * particle_idx), quantizedCode(3 * particle_idx + 1), quantizedCode(3 * particle_idx + 2));
+    return chunk.min.xyz + vec3(code) * chunk.step.xyz;
+}
+
+// Compact layouts keep particles in the order they were added, so the group is
+// the last one starting at or before the particle
+uint compactDrawGroup(uint particle_idx)
+{
+    uint low = 0;
+    uint high = n_draw_groups - 1;
+    while(low < high)
+    {
+        uint middle = (low + high + 1) / 2;
+        if(draw_group[middle].first <= particle_idx)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
 out vec2 uv;
 out VECTOR3 particle_pos_vs;
+flat out float particle_radius;
+out VECTOR3 quad_pos_vs;    // RAY_CAST
+out VECTOR3 mesh_normal_vs; // MESH
 
 
 
@@ -48,8 +166,19 @@ out VECTOR3 particle_pos_vs;
 
 void main()
 {
+    // Fullscreen triangle resolving the OIT targets
+    if(render_mode == COMPOSITE)
+    {
+        vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+        gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+        uv = vec2(0.0);
+        return;
+    }
+
     vec4 pos = vec4(0.0, 0.0, 0.0, 1.0);
-    int point_idx = gl_VertexID / 6;
+    uint group = 0;
+    const bool instanced = quad_path == INSTANCED_STRIP || sphere_mode == MESH;
+    int point_idx = instanced ? int(first_particle) + gl_InstanceID : gl_VertexID / 6;
 
 
     if(render_mode == DEBUG)
@@ -58,9 +187,24 @@ void main()
 
     else if(render_mode == DIFFUSE)
     {
-        pos = vec4(particle[point_idx].position, 1.0);
-        
-        diffuse_colour = particle[point_idx].colour;
+        if(particle_layout == COMPACT || particle_layout == QUANTIZED)
+        {
+            uint particle_idx = draw_order[point_idx];
+            if(particle_layout == QUANTIZED)
+                pos = vec4(decodeQuantizedPosition(particle_idx), 1.0);
+            else
+                pos = vec4(compact_position[3 * particle_idx], compact_position[3 * particle_idx + 1], compact_position[3 * particle_idx + 2], 1.0);
+            diffuse_colour = unpackUnorm4x8(compact_colour[particle_idx]);
+            if(n_draw_groups > 1)
+                group = compactDrawGroup(particle_idx);
+        }
+        else
+        {
+            uint particle_idx = gpu_sorted ? draw_order[point_idx] : uint(point_idx);
+            pos = vec4(particle[particle_idx].position.xyz, 1.0);
+            diffuse_colour = particle[particle_idx].colour;
+            group = uint(particle[particle_idx].position.w);
+        }
 
         particle_pos_vs = VECTOR3(view * pos);
     }
@@ -76,8 +220,65 @@ void main()
                             };
 
 
-    float rx = radius;
-    float ry = radius;
+    particle_radius = draw_group[group].radius;
+    float rx = particle_radius;
+    float ry = particle_radius;
+    if(sphere_mode == MESH)
+    {
+        vec3 normal_ws = sphere_mesh_vertex[gl_VertexID].xyz;
+        gl_Position = view_projection * vec4(pos.xyz + particle_radius * normal_ws, 1.0);
+        mesh_normal_vs = mat3(view) * normal_ws;
+        uv = vec2(0.0);
+        return;
+    }
+
+    // Strip order br, bl, tr, tl keeps the clockwise winding of the indexed triangles
+    const int strip_corner[4] = {0, 2, 1, 3};
+    if(sphere_mode == RAY_CAST)
+    {
+        // The exact screen rectangle of the sphere, from the slopes x/z and y/z
+        // of the tangents through the eye, placed at the sphere's nearest depth:
+        // every ray crosses it before the sphere, so the surface depth is never
+        // less than the quad's. Assumes a symmetric projection with w = z.
+        int corner = instanced ? strip_corner[gl_VertexID] : indices[gl_VertexID % 6];
+        uv = quad_uv[corner];
+        vec3 centre = particle_pos_vs;
+        float near = -projection[3][2] / (projection[2][2] + 1.0);
+        float depth = centre.z - particle_radius;
+        vec2 slope;
+        if(centre.z + particle_radius < near)
+        {
+            // Entirely nearer than the near plane, nothing to draw
+            gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+            return;
+        }
+        else if(depth < near)
+        {
+            // Crosses the near plane, bounded by the whole screen
+            depth = near;
+            slope = uv / vec2(projection[0][0], projection[1][1]);
+        }
+        else
+        {
+            float radius_squared = particle_radius * particle_radius;
+            vec2 tangent = sqrt(centre.xy * centre.xy + centre.z * centre.z - radius_squared);
+            vec2 low = (centre.xy * centre.z - particle_radius * tangent) / (centre.z * centre.z - radius_squared);
+            vec2 high = (centre.xy * centre.z + particle_radius * tangent) / (centre.z * centre.z - radius_squared);
+            slope = mix(low, high, step(0.0, uv));
+        }
+        quad_pos_vs = vec3(slope * depth, depth);
+        gl_Position = projection * vec4(quad_pos_vs, 1.0);
+        return;
+    }
+
+    if(instanced)
+    {
+        int corner = strip_corner[gl_VertexID];
+        gl_Position = view_projection * (pos + vec4(rx * quad_uv[corner].x * billboard_right + ry * quad_uv[corner].y * billboard_up, 0.0));
+        uv = quad_uv[corner];
+        return;
+    }
+
     MATRIX4 view_to_world_transform = inverse(view);
     vec4 x = view_to_world_transform[0];
     vec4 y = view_to_world_transform[1];
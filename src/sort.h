@@ -0,0 +1,264 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include "defintions.h"
+#include "threading.h"
+#include <vector>
+#include <array>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+
+
+// Maps a non-negative f32 onto a u32 whose ascending order is the float's
+// descending order, so an ascending radix sort yields back-to-front order.
+inline u32 farToNearKey(f32 distance_squared)
+{
+    return ~std::bit_cast<u32>(distance_squared);
+}
+
+
+constexpr i32 RADIX_BITS = 8;
+constexpr i32 RADIX_BUCKETS = 1 << RADIX_BITS;
+constexpr i32 RADIX_PASSES = 32 / RADIX_BITS;
+constexpr i64 RADIX_MIN_BATCH = 1 << 14;
+
+struct RadixSortScratch
+{
+    std::vector<u32> keys_alt;
+    std::vector<u32> indices_alt;
+    std::vector<std::array<u32, RADIX_BUCKETS>> histograms;
+};
+
+// Stable LSD radix sort of count (keys, indices) pairs by key, ascending. Each
+// pass builds one histogram per batch so the scatter can run on every thread
+// without atomics. Passes where every key shares the same digit are skipped.
+inline void radixSortKeyIndex(u32 *keys, u32 *indices, i64 count, RadixSortScratch &scratch)
+{
+    if(count < 2)
+        return;
+
+    scratch.keys_alt.resize(count);
+    scratch.indices_alt.resize(count);
+
+    const i32 n_batches = batchCount(count, RADIX_MIN_BATCH);
+    const i64 batch_size = (count + n_batches - 1) / n_batches;
+    scratch.histograms.resize(n_batches);
+
+    u32 *src_keys = keys;
+    u32 *src_indices = indices;
+    u32 *dst_keys = scratch.keys_alt.data();
+    u32 *dst_indices = scratch.indices_alt.data();
+
+    for(i32 pass = 0; pass < RADIX_PASSES; ++pass)
+    {
+        const u32 shift = pass * RADIX_BITS;
+
+        globalThreadPool().run(n_batches, [&](i32 batch)
+        {
+            auto &histogram = scratch.histograms[batch];
+            histogram.fill(0);
+            i64 begin = batch * batch_size;
+            i64 end = std::min(count, begin + batch_size);
+            for(i64 i = begin; i < end; ++i)
+                ++histogram[(src_keys[i] >> shift) & (RADIX_BUCKETS - 1)];
+        });
+
+        // Every key landing in one bucket means this digit doesn't reorder anything.
+        bool trivial_pass = false;
+        for(i32 digit = 0; digit < RADIX_BUCKETS; ++digit)
+        {
+            u64 digit_total = 0;
+            for(i32 batch = 0; batch < n_batches; ++batch)
+                digit_total += scratch.histograms[batch][digit];
+            if(digit_total == static_cast<u64>(count))
+                trivial_pass = true;
+            if(digit_total != 0)
+                break;
+        }
+        if(trivial_pass)
+            continue;
+
+        // Exclusive prefix over (digit, batch) turns the counts into scatter offsets.
+        u32 running = 0;
+        for(i32 digit = 0; digit < RADIX_BUCKETS; ++digit)
+        {
+            for(i32 batch = 0; batch < n_batches; ++batch)
+            {
+                u32 n = scratch.histograms[batch][digit];
+                scratch.histograms[batch][digit] = running;
+                running += n;
+            }
+        }
+
+        globalThreadPool().run(n_batches, [&](i32 batch)
+        {
+            auto &offsets = scratch.histograms[batch];
+            i64 begin = batch * batch_size;
+            i64 end = std::min(count, begin + batch_size);
+            for(i64 i = begin; i < end; ++i)
+            {
+                u32 key = src_keys[i];
+                u32 destination = offsets[(key >> shift) & (RADIX_BUCKETS - 1)]++;
+                dst_keys[destination] = key;
+                dst_indices[destination] = src_indices[i];
+            }
+        });
+
+        std::swap(src_keys, dst_keys);
+        std::swap(src_indices, dst_indices);
+    }
+
+    if(src_keys != keys)
+    {
+        memcpy(keys, src_keys, count * sizeof(u32));
+        memcpy(indices, src_indices, count * sizeof(u32));
+    }
+}
+
+
+// A (key, index) pair in one u64, the key in the high half. Pairs compare by
+// key and then index, the order radixSortKeyIndex gives indices that start out
+// ascending.
+inline u64 keyIndexPair(u32 key, u32 index)
+{
+    return (static_cast<u64>(key) << 32) | index;
+}
+
+inline u32 pairIndex(u64 pair)
+{
+    return static_cast<u32>(pair);
+}
+
+// Element moves per element past which repairing an order costs about as much
+// as radix sorting it, measured with cpu_benchmark. The allowance keeps one
+// particle that moved far early in a batch from ending the repair.
+constexpr i64 INSERTION_MOVES_PER_ELEMENT = 4;
+constexpr i64 INSERTION_MOVE_ALLOWANCE = 4096;
+
+// Sorts pairs that are close to sorted already: an insertion
+// sort of each batch, then merges of neighbouring runs that only touch the
+// elements where the runs overlap. Costs about linear time plus the distance
+// elements move, so it suits last frame's order re-keyed for this frame.
+// Returns the insertion sort's element moves, or -1 with pairs partly sorted
+// once they pass INSERTION_MOVES_PER_ELEMENT per element.
+inline i64 sortNearlySortedPairs(u64 *pairs, i64 count)
+{
+    if(count < 2)
+        return 0;
+    const i32 n_batches = batchCount(count, RADIX_MIN_BATCH);
+    const i64 batch_size = (count + n_batches - 1) / n_batches;
+    std::atomic<i64> total_moves = 0;
+    std::atomic<bool> too_far = false;
+    globalThreadPool().run(n_batches, [&](i32 batch)
+    {
+        i64 begin = batch * batch_size;
+        i64 end = std::min(count, begin + batch_size);
+        i64 moves = 0;
+        for(i64 i = begin + 1; i < end; ++i)
+        {
+            const u64 pair = pairs[i];
+            i64 j = i;
+            for(; j > begin && pairs[j - 1] > pair; --j)
+                pairs[j] = pairs[j - 1];
+            pairs[j] = pair;
+            moves += i - j;
+            // Checked as it goes, so disorder spread evenly gives up early.
+            if(moves > INSERTION_MOVES_PER_ELEMENT * (i - begin) + INSERTION_MOVE_ALLOWANCE || too_far.load(std::memory_order_relaxed))
+            {
+                too_far = true;
+                return;
+            }
+        }
+        total_moves += moves;
+    });
+    if(too_far)
+        return -1;
+
+    for(i64 width = batch_size; width < count; width *= 2)
+    {
+        const i32 n_merges = static_cast<i32>((count + 2 * width - 1) / (2 * width));
+        globalThreadPool().run(n_merges, [&](i32 merge)
+        {
+            u64 *begin = pairs + merge * 2 * width;
+            u64 *middle = pairs + std::min(count, merge * 2 * width + width);
+            u64 *end = pairs + std::min(count, merge * 2 * width + 2 * width);
+            if(middle == end || *(middle - 1) < *middle)
+                return;
+            // Only the left pairs above the right's first and the right pairs
+            // below the left's last change places.
+            u64 *overlap_begin = std::upper_bound(begin, middle, *middle);
+            u64 *overlap_end = std::lower_bound(middle, end, *(middle - 1));
+            std::inplace_merge(overlap_begin, middle, overlap_end);
+        });
+    }
+    return total_moves;
+}
+
+// Stable parallel partition of [0, count) that may leave indices out:
+// classify(i) returns 0 to put i in the first group, 1 for the second and
+// anything else to drop it. Both groups are written to the front of indices in
+// ascending order, the first ahead of the second. Returns the size of the
+// first group and sets n_kept to that of both together.
+template <typename F>
+i64 partitionKeptIndices(i64 count, F &&classify, u32 *indices, std::vector<i64> &batch_counts, i64 &n_kept)
+{
+    const i32 n_batches = batchCount(count, RADIX_MIN_BATCH);
+    const i64 batch_size = (count + n_batches - 1) / n_batches;
+    batch_counts.resize(2 * n_batches);
+
+    globalThreadPool().run(n_batches, [&](i32 batch)
+    {
+        i64 begin = std::min(count, batch * batch_size);
+        i64 end = std::min(count, begin + batch_size);
+        i64 n_group[2] = {0, 0};
+        for(i64 i = begin; i < end; ++i)
+        {
+            const u32 group = classify(i);
+            if(group < 2)
+                ++n_group[group];
+        }
+        batch_counts[2 * batch] = n_group[0];
+        batch_counts[2 * batch + 1] = n_group[1];
+    });
+
+    i64 total_first = 0;
+    i64 total_second = 0;
+    for(i32 batch = 0; batch < n_batches; ++batch)
+    {
+        i64 n_first = batch_counts[2 * batch];
+        i64 n_second = batch_counts[2 * batch + 1];
+        batch_counts[2 * batch] = total_first;
+        batch_counts[2 * batch + 1] = total_second;
+        total_first += n_first;
+        total_second += n_second;
+    }
+
+    globalThreadPool().run(n_batches, [&](i32 batch)
+    {
+        i64 begin = std::min(count, batch * batch_size);
+        i64 end = std::min(count, begin + batch_size);
+        i64 out[2] = {batch_counts[2 * batch], total_first + batch_counts[2 * batch + 1]};
+        for(i64 i = begin; i < end; ++i)
+        {
+            const u32 group = classify(i);
+            if(group < 2)
+                indices[out[group]++] = static_cast<u32>(i);
+        }
+    });
+    n_kept = total_first + total_second;
+    return total_first;
+}
+
+// Stable parallel partition of [0, count): the indices for which in_first(i)
+// holds are written to the front of indices, the rest after them, both in
+// ascending order. Returns the size of the first group.
+template <typename F>
+i64 partitionIndices(i64 count, F &&in_first, u32 *indices, std::vector<i64> &batch_counts)
+{
+    i64 n_kept;
+    return partitionKeptIndices(count, [&](i64 i){ return in_first(i) ? 0u : 1u; }, indices, batch_counts, n_kept);
+}
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef THREADING_H
+#define THREADING_H
+
+#include "defintions.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+
+// Persistent workers for data-parallel loops over particles. The calling thread
+// takes part in the work, so a pool with n workers runs n + 1 batches at a time.
+struct ThreadPool
+{
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+
+    std::function<void(i32)> job;
+    i32 n_jobs;
+    i32 next_job;
+    i32 jobs_finished;
+    u64 generation;
+    bool shutting_down;
+
+    ThreadPool(i32 n_workers) : n_jobs{0}, next_job{0}, jobs_finished{0}, generation{0}, shutting_down{false}
+    {
+        for(i32 i = 0; i < n_workers; ++i)
+            workers.emplace_back([this]{ workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            shutting_down = true;
+        }
+        work_ready.notify_all();
+        for(auto &worker : workers) worker.join();
+    }
+
+    i32 threadCount() const { return static_cast<i32>(workers.size()) + 1; }
+
+    void workerLoop()
+    {
+        u64 seen_generation = 0;
+        while(true)
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            work_ready.wait(guard, [&]{ return shutting_down || (generation != seen_generation && next_job < n_jobs); });
+            if(shutting_down)
+                return;
+            seen_generation = generation;
+            guard.unlock();
+            runJobs();
+        }
+    }
+
+    void runJobs()
+    {
+        while(true)
+        {
+            i32 job_id;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if(next_job >= n_jobs)
+                    return;
+                job_id = next_job++;
+            }
+            job(job_id);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if(++jobs_finished == n_jobs)
+                    work_done.notify_all();
+            }
+        }
+    }
+
+    // Runs fn(job_id) for job_id in [0, n) and returns once every job has finished.
+    void run(i32 n, std::function<void(i32)> fn)
+    {
+        if(n <= 0)
+            return;
+        if(n == 1 || workers.empty())
+        {
+            for(i32 i = 0; i < n; ++i) fn(i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            job = std::move(fn);
+            n_jobs = n;
+            next_job = 0;
+            jobs_finished = 0;
+            ++generation;
+        }
+        work_ready.notify_all();
+        runJobs();
+        std::unique_lock<std::mutex> guard(lock);
+        work_done.wait(guard, [&]{ return jobs_finished == n_jobs; });
+    }
+};
+
+inline ThreadPool &globalThreadPool()
+{
+    static ThreadPool pool{std::max(1, static_cast<i32>(std::thread::hardware_concurrency())) - 1};
+    return pool;
+}
+
+
+// Number of batches to split count items into so that each batch holds at least min_batch items.
+inline i32 batchCount(i64 count, i64 min_batch)
+{
+    i64 max_batches = globalThreadPool().threadCount();
+    i64 batches = std::min(max_batches, (count + min_batch - 1) / min_batch);
+    return static_cast<i32>(std::max<i64>(batches, 1));
+}
+
+// Calls fn(batch, begin, end) over contiguous ranges of [0, count) in parallel.
+template <typename F>
+void parallelFor(i64 count, i64 min_batch, F &&fn)
+{
+    i32 n_batches = batchCount(count, min_batch);
+    i64 batch_size = (count + n_batches - 1) / n_batches;
+    globalThreadPool().run(n_batches, [&](i32 batch)
+    {
+        i64 begin = batch * batch_size;
+        i64 end = std::min(count, begin + batch_size);
+        if(begin < end)
+            fn(batch, begin, end);
+    });
+}
+
+
+// Workers draining a FIFO of independent tasks that may finish after the
+// caller has moved on. At most max_queued tasks wait at once: submit blocks
+// while the queue is full, which keeps a fast producer from running ahead of
+// the workers. With no workers tasks run inline in submit.
+struct TaskQueue
+{
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable task_ready;
+    std::condition_variable space_ready;
+    std::condition_variable tasks_done;
+
+    std::deque<std::function<void()>> tasks;
+    i32 max_queued;
+    i32 n_running;
+    bool shutting_down;
+
+    TaskQueue(i32 n_workers, i32 max_queued) : max_queued{std::max(1, max_queued)}, n_running{0}, shutting_down{false}
+    {
+        for(i32 i = 0; i < n_workers; ++i)
+            workers.emplace_back([this]{ workerLoop(); });
+    }
+
+    // Finishes the queued tasks before joining.
+    ~TaskQueue()
+    {
+        wait();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            shutting_down = true;
+        }
+        task_ready.notify_all();
+        for(auto &worker : workers) worker.join();
+    }
+
+    void workerLoop()
+    {
+        while(true)
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            task_ready.wait(guard, [&]{ return shutting_down || !tasks.empty(); });
+            if(tasks.empty())
+                return;
+            std::function<void()> task = std::move(tasks.front());
+            tasks.pop_front();
+            ++n_running;
+            guard.unlock();
+            space_ready.notify_one();
+
+            task();
+
+            guard.lock();
+            if(--n_running == 0 && tasks.empty())
+                tasks_done.notify_all();
+        }
+    }
+
+    void submit(std::function<void()> task)
+    {
+        if(workers.empty())
+        {
+            task();
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            space_ready.wait(guard, [&]{ return static_cast<i32>(tasks.size()) < max_queued; });
+            tasks.push_back(std::move(task));
+        }
+        task_ready.notify_one();
+    }
+
+    // Returns once every submitted task has finished.
+    void wait()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        tasks_done.wait(guard, [&]{ return tasks.empty() && n_running == 0; });
+    }
+};
+
+#endif
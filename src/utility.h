@@ -6,6 +6,8 @@
 #include "string_view"
 #include <fstream>
 #include <cassert>
+#include <memory>
+#include <vector>
 
 
 
@@ -14,7 +16,7 @@
 
 
 
-std::string_view loadFile(StackArena &arena, const char* path)
+inline std::string_view loadFile(StackArena &arena, const char* path)
 {
     std::ifstream file_stream {path, std::ifstream::binary};
     
@@ -31,7 +33,7 @@ std::string_view loadFile(StackArena &arena, const char* path)
 }
 
 
-u32 stringToU32(const char* str, u8 length)
+inline u32 stringToU32(const char* str, u8 length)
 {
     assert(length <= 10 && length > 0);
     u32 result = 0;
@@ -43,6 +45,40 @@ u32 stringToU32(const char* str, u8 length)
     return result;
 }
 
+// Allocator that default-initialises instead of value-initialising, so resizing a
+// vector of trivial types doesn't zero memory that is about to be overwritten.
+template <typename T, typename A = std::allocator<T>>
+struct DefaultInitAllocator : public A
+{
+    using traits = std::allocator_traits<A>;
+    template <typename U> struct rebind { using other = DefaultInitAllocator<U, typename traits::template rebind_alloc<U>>; };
+    using A::A;
+
+    template <typename U>
+    void construct(U *ptr) noexcept(std::is_nothrow_default_constructible<U>::value) { ::new(static_cast<void*>(ptr)) U; }
+    template <typename U, typename... Args>
+    void construct(U *ptr, Args&&... args) { traits::construct(static_cast<A&>(*this), ptr, std::forward<Args>(args)...); }
+};
+
+template <typename T>
+using UninitialisedVector = std::vector<T, DefaultInitAllocator<T>>;
+
+// Reverses the order of height rows of row_bytes in place, one row at a time
+// through row_scratch, so no image sized copy is made.
+inline void flipRowsInPlace(u8 *pixels, i64 row_bytes, i64 height, std::vector<u8> &row_scratch)
+{
+    row_scratch.resize(row_bytes);
+    for(i64 row = 0; row < height / 2; ++row)
+    {
+        u8 *top = pixels + row * row_bytes;
+        u8 *bottom = pixels + (height - 1 - row) * row_bytes;
+        memcpy(row_scratch.data(), top, row_bytes);
+        memcpy(top, bottom, row_bytes);
+        memcpy(bottom, row_scratch.data(), row_bytes);
+    }
+}
+
+
 // should log to file
 
 // for release
@@ -243,6 +243,7 @@ def render(window, camera, scene, canvas):
 
 def main():
     renderer = GlRenderer(2000, 2000)
+    renderer.setSaveThreads(4)
     background_colour = np.array([0.0, 0.0, 0.0])
     renderer.setBackgroundColour(background_colour)
     pos = np.array([0.5, 0.5, -3.0])
@@ -277,5 +278,7 @@ def main():
 
         frame_id +=1
 
+    renderer.flushSaves()
+
 if __name__ == "__main__":
     main()
\ No newline at end of file